@@ -0,0 +1,337 @@
+/**
+ * Micro benchmarks for btree.h.
+ *
+ * Node memory options are compile time switches, build one binary per variant and compare:
+ *   g++ -std=c++20 -O2 -I.. btree_bench.cpp -o btree_bench
+ *   g++ -std=c++20 -O2 -I.. -DBTREE_HUGEPAGE btree_bench.cpp -o btree_bench_huge
+ *   ./btree_bench -n 256M && ./btree_bench_huge -n 256M
+ *
+ * Other benchmarks are picked with -b, e.g. `./btree_bench -b queue -n 1M`. Build with -mavx2
+ * (or -march=native) for the SIMD node search and search defaults that match it.
+ *
+ * Hardware counters are read through perf_event_open, they show up as n/a where that is not
+ * permitted (see /proc/sys/kernel/perf_event_paranoid).
+ */
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <set>
+
+// args.h leans on btree.h for <algorithm> and <array>
+#include "btree.h"
+#include "args.h"
+
+enum class Bench {
+    Find,
+    Queue,
+    Search,
+};
+
+struct Config {
+    Bench bench;
+    size_t n;
+    size_t ops;
+    unsigned seed;
+    size_t width;
+} conf;
+
+static arg::Parser parser{
+    arg::Arg('b', conf.bench, "bench", Bench::Find, "benchmark to run"),
+    arg::SizeArg('n', conf.n, "keys", size_t(16) << 20, "number of keys in the tree"),
+    arg::SizeArg('o', conf.ops, "ops", size_t(8) << 20, "number of operations to time"),
+    arg::Arg('s', conf.seed, "seed", 42u, "random seed"),
+    arg::Arg('w', conf.width, "width", size_t(12), "lookups in flight for find_async"),
+};
+
+// one hardware event of the calling thread, counting between start() and stop()
+class PerfCounter {
+    int fd;
+
+public:
+    PerfCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~PerfCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    std::optional<uint64_t> stop() {
+        uint64_t cnt;
+        if (fd < 0 || ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) != 0 || read(fd, &cnt, sizeof(cnt)) != sizeof(cnt)) {
+            return {};
+        }
+        return cnt;
+    }
+};
+
+static constexpr uint64_t kDtlbLoadMiss = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+// times run(), which does ops operations, with dTLB load misses and cache misses per op
+template <typename Run>
+void measureBatch(const char *name, size_t ops, Run run) {
+    PerfCounter dtlb(PERF_TYPE_HW_CACHE, kDtlbLoadMiss);
+    PerfCounter llc(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    dtlb.start();
+    llc.start();
+    auto begin = std::chrono::steady_clock::now();
+    run();
+    auto end = std::chrono::steady_clock::now();
+    auto dtlbMiss = dtlb.stop();
+    auto llcMiss = llc.stop();
+
+    auto perOp = [ops](std::optional<uint64_t> cnt) {
+        std::ostringstream os;
+        if (cnt) {
+            os << std::fixed << std::setprecision(3) << double(*cnt) / ops;
+        } else {
+            os << "n/a";
+        }
+        return os.str();
+    };
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << std::chrono::duration<double, std::nano>(end - begin).count() / ops << " ns/op"
+              << std::setw(10) << perOp(dtlbMiss) << " dTLB-miss/op" << std::setw(10) << perOp(llcMiss)
+              << " cache-miss/op" << std::endl;
+}
+
+// times fn(i) for i in [0, ops)
+template <typename Fn>
+void measure(const char *name, size_t ops, Fn fn) {
+    measureBatch(name, ops, [&]() {
+        for (size_t i = 0; i < ops; i++) {
+            fn(i);
+        }
+    });
+}
+
+// huge pages backing this process, transparent and explicit
+static void printHugePages() {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(smaps, line)) {
+        if (line.rfind("AnonHugePages:", 0) == 0) {
+            std::cout << line << std::endl;
+        }
+    }
+    std::ifstream meminfo("/proc/meminfo");
+    while (std::getline(meminfo, line)) {
+        if (line.rfind("HugePages_Total:", 0) == 0 || line.rfind("HugePages_Free:", 0) == 0) {
+            std::cout << line << std::endl;
+        }
+    }
+}
+
+// odd keys, so that every even key is a miss
+static std::vector<std::pair<uint64_t, uint64_t>> sortedKeys(size_t n) {
+    std::vector<std::pair<uint64_t, uint64_t>> keys(n);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = {2 * i + 1, i};
+    }
+    return keys;
+}
+
+static std::vector<uint64_t> randomProbes(size_t ops, size_t n) {
+    std::mt19937_64 rng(conf.seed);
+    std::vector<uint64_t> probes(ops);
+    for (auto &p : probes) {
+        p = 2 * (rng() % n) + 1;
+    }
+    return probes;
+}
+
+static void benchFind() {
+    BTree<uint64_t, uint64_t> tree;
+    {
+        auto keys = sortedKeys(conf.n);
+        tree.bulk_load(keys.begin(), keys.end());
+    }
+    auto probes = randomProbes(conf.ops, conf.n);
+#ifdef BTREE_HUGEPAGE
+    std::cout << "node memory: huge pages" << std::endl;
+#else
+    std::cout << "node memory: default" << std::endl;
+#endif
+    printHugePages();
+
+    uint64_t sum = 0;
+    measure("find (random hit)", conf.ops, [&](size_t i) {
+        sum += tree.find(probes[i]).val();
+    });
+    measure("find (random miss)", conf.ops, [&](size_t i) {
+        sum += tree.find(probes[i] + 1).valid();
+    });
+    measureBatch("find_async (random hit)", conf.ops, [&]() {
+        coro::interleave(conf.width, conf.ops, [&](size_t i) { return tree.find_async(probes[i]); },
+                         [&](size_t, auto &cursor) { sum += cursor.val(); });
+    });
+    // keep the lookups alive
+    std::cout << "checksum " << sum << std::endl;
+}
+
+// Earliest deadline first: n pending items, every op takes the earliest one and schedules a
+// new item a random distance into the future.
+static void benchQueue() {
+    std::mt19937_64 rng(conf.seed);
+    std::vector<uint64_t> delays(conf.ops);
+    for (auto &d : delays) {
+        // spread wide enough that deadlines stay unique
+        d = 1 + rng() % (uint64_t(conf.n) << 16);
+    }
+    std::vector<uint64_t> initial(conf.n);
+    for (auto &d : initial) {
+        d = rng() % (uint64_t(conf.n) << 16);
+    }
+
+    {
+        BTreeMap<uint64_t, uint64_t> tree;
+        for (auto d : initial) {
+            if (!tree.find(d).valid()) {
+                tree.insert(d, d);
+            }
+        }
+        measure("BTreeMap pop_front", conf.ops, [&](size_t i) {
+            auto now = tree.front().key();
+            tree.pop_front();
+            for (auto d = now + delays[i]; ; d++) {
+                if (!tree.find(d).valid()) {
+                    tree.insert(d, d);
+                    break;
+                }
+            }
+        });
+    }
+    {
+        std::set<uint64_t> set(initial.begin(), initial.end());
+        measure("std::set", conf.ops, [&](size_t i) {
+            auto now = *set.begin();
+            set.erase(set.begin());
+            for (auto d = now + delays[i]; !set.insert(d).second; d++) {
+            }
+        });
+    }
+    {
+        std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<>> pq(initial.begin(), initial.end());
+        measure("std::priority_queue", conf.ops, [&](size_t i) {
+            auto now = pq.top();
+            pq.pop();
+            pq.push(now + delays[i]);
+        });
+    }
+}
+
+// node-shaped sorted key arrays, filled like the nodes of a randomly grown tree
+template <typename K, unsigned N>
+struct SearchNodes {
+    static constexpr size_t kNodes = 1024;
+    std::vector<std::array<K, N>> keys;
+    std::vector<unsigned> lens;
+    std::vector<std::pair<unsigned, K>> probes;
+
+    template <typename Gen>
+    SearchNodes(size_t ops, Gen gen): keys(kNodes), lens(kNodes) {
+        std::mt19937_64 rng(conf.seed);
+        for (size_t i = 0; i < kNodes; i++) {
+            lens[i] = N / 2 + rng() % (N - N / 2 + 1);
+            for (unsigned j = 0; j < lens[i]; j++) {
+                keys[i][j] = gen(rng);
+            }
+            std::sort(keys[i].begin(), keys[i].begin() + lens[i]);
+        }
+        probes.resize(ops);
+        for (auto &p : probes) {
+            p = {unsigned(rng() % kNodes), gen(rng)};
+        }
+    }
+};
+
+template <template <typename, typename> class Search, typename K, unsigned N>
+void measureSearch(const char *strategy, const char *type, const SearchNodes<K, N> &nodes) {
+    using Cmp = std::less<K>;
+    auto name = std::string(type) + " " + std::to_string(N + 1) + " " + strategy;
+    unsigned sum = 0;
+    measure(name.c_str(), nodes.probes.size(), [&](size_t i) {
+        auto &[node, key] = nodes.probes[i];
+        sum += Search<K, Cmp>::template locate<N>(nodes.keys[node].data(), nodes.lens[node], key);
+    });
+    if (sum == 1) {
+        std::cout << std::endl;
+    }
+}
+
+template <typename K, unsigned ORDER, typename Gen>
+void benchSearchFor(const char *type, Gen gen) {
+    constexpr unsigned N = ORDER - 1;
+    SearchNodes<K, N> nodes(conf.ops, gen);
+    measureSearch<LinearSearch>("linear", type, nodes);
+    measureSearch<BranchlessSearch>("branchless", type, nodes);
+#ifdef __AVX2__
+    if constexpr (std::is_arithmetic_v<K> && (sizeof(K) == 4 || sizeof(K) == 8)) {
+        measureSearch<SimdSearch>("simd", type, nodes);
+    }
+#endif
+}
+
+template <typename K, typename Gen>
+void benchSearchType(const char *type, Gen gen) {
+    benchSearchFor<K, 8>(type, gen);
+    benchSearchFor<K, 12>(type, gen);
+    benchSearchFor<K, 16>(type, gen);
+    benchSearchFor<K, 32>(type, gen);
+    benchSearchFor<K, 64>(type, gen);
+    benchSearchFor<K, 128>(type, gen);
+}
+
+// node search strategies (type, ORDER, strategy) on random keys, see BTreeKeyTraits
+static void benchSearch() {
+    benchSearchType<uint32_t>("u32", [](auto &rng) { return uint32_t(rng()); });
+    benchSearchType<uint64_t>("u64", [](auto &rng) { return uint64_t(rng()); });
+    benchSearchType<double>("double", [](auto &rng) { return double(rng()) / 3; });
+    benchSearchType<std::string>("string", [](auto &rng) { return std::to_string(rng() % 1000000); });
+}
+
+int main(int argc, const char *argv[]) {
+    try {
+        parser.parse(argc, argv);
+        parser.printAll(std::cout);
+    } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        parser.usage(std::cerr, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (conf.bench) {
+    case Bench::Find:
+        benchFind();
+        break;
+    case Bench::Queue:
+        benchQueue();
+        break;
+    case Bench::Search:
+        benchSearch();
+        break;
+    }
+    return 0;
+}
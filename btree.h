@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <iomanip>
 #include <iostream>
 #include <limits>
@@ -9,7 +10,74 @@
 #include <memory>
 #include <optional>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/** link nodes by 32-bit arena indices instead of pointers
+ * Nodes of all trees are then allocated from one process-wide arena (up to 64GB of nodes), which
+ * halves the size of child and parent links.
+ */
+// #define BTREE_COMPACT_NODES
+
+/** back node memory by 2MB huge pages
+ * Nodes are allocated from the same arena as with BTREE_COMPACT_NODES, committed in huge page
+ * sized pieces: explicit huge pages (MAP_HUGETLB) while the system has some reserved, transparent
+ * ones (MADV_HUGEPAGE) otherwise. Cuts dTLB misses of random lookups on large trees.
+ */
+// #define BTREE_HUGEPAGE
+
+/** count splits, merges and borrows of all trees in hwstat counters
+ * Every tree keeps its own counts for stats() regardless; this adds process-wide per-thread
+ * counters (btreeSplits, btreeMerges, btreeBorrows) that show up in hwstat::print_counter_stats().
+ */
+// #define BTREE_STATS
+
+/** free nodes through epoch-based reclamation (ebr.h)
+ * Nodes dropped by a merge, a root collapse or erase_prefix() are retired rather than freed, so a
+ * reader inside an ebr::Guard may keep following pointers it loaded before the writer unlinked
+ * them. Destruction, bulk loads and move assignment free the old nodes directly, no reader may
+ * overlap those. The tree still does not synchronize readers with writers by itself.
+ * Only nodes are covered: out-of-line values (BTreeValueTraits) of removed entries go back to
+ * their slab right away and must not be read once a writer may be removing their entry.
+ */
+// #define BTREE_EBR
+
+#ifdef BTREE_EBR
+#include "ebr.h"
+#endif
+
+#ifdef BTREE_STATS
+#include "hwstat.h"
+COUNTER(btreeSplits, "BTree node splits", inline);
+COUNTER(btreeMerges, "BTree node merges", inline);
+COUNTER(btreeBorrows, "BTree entries borrowed from a sibling", inline);
+#define BTREE_COUNT(_counter) _counter++
+#else
+#define BTREE_COUNT(_counter)
+#endif
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define BTREE_COROUTINES
+#include "coro.h"
+#endif
+
+#if defined(BTREE_COMPACT_NODES) || defined(BTREE_HUGEPAGE)
+#define BTREE_NODE_ARENA
+#include <sys/mman.h>
+#endif
 
 #define BTREE_TPL template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
 #define BTREE_TPL_NODEF template <typename K, typename V, unsigned ORDER, typename Cmp>
@@ -27,56 +95,977 @@ struct NullStream {
 static NullStream dbg;
 #endif
 
+/**
+ * Node search strategies for keys stored as is, each usable as a BTreeKeyTraits.
+ * locate<N>(keys, len, key) returns the index of the first of len <= N sorted keys that is not
+ * less than key, N being the capacity of the node.
+ */
+template <typename K, typename Cmp>
+struct LinearSearch {
+    using Stored = K;
+
+    template <unsigned N>
+    static unsigned locate(const K *keys, unsigned len, const K &key) {
+        return std::find_if(keys, keys + len, [&key](const K &k) {
+            return !Cmp()(k, key);
+        }) - keys;
+    }
+};
+
+/**
+ * Binary search in steps of halving powers of two, unrolled for the node capacity at compile
+ * time. Every step is one compare and a conditional move, so random keys cause no branch
+ * mispredictions, and the number of steps does not depend on len.
+ */
+template <typename K, typename Cmp>
+struct BranchlessSearch {
+    using Stored = K;
+
+    static constexpr unsigned floorPow2(unsigned n) {
+        unsigned p = 1;
+        while (p * 2 <= n) {
+            p *= 2;
+        }
+        return p;
+    }
+
+    template <unsigned Step>
+    static void step(const K *keys, unsigned len, const K &key, unsigned &pos) {
+        auto probe = pos + Step;
+        // slots past len count as not less, the clamped read only keeps the compare in bounds
+        bool less = (probe <= len) & Cmp()(keys[std::min(probe, len) - 1], key);
+        pos = less ? probe : pos;
+        if constexpr (Step > 1) {
+            step<Step / 2>(keys, len, key, pos);
+        }
+    }
+
+    template <unsigned N>
+    static unsigned locate(const K *keys, unsigned len, const K &key) {
+        if (len == 0) {
+            return 0;
+        }
+        unsigned pos = 0;
+        step<floorPow2(N)>(keys, len, key, pos);
+        return pos;
+    }
+};
+
+#ifdef __AVX2__
+/**
+ * Counts the keys less than key 32 bytes at a time with AVX2 compares, for 4 and 8 byte integer
+ * and floating point keys under std::less. Lanes past len are masked out of load and count.
+ */
+template <typename K, typename Cmp>
+struct SimdSearch {
+    static_assert(std::is_arithmetic_v<K> && (sizeof(K) == 4 || sizeof(K) == 8) && std::is_same_v<Cmp, std::less<K>>,
+                  "SimdSearch needs 4 or 8 byte arithmetic keys and std::less");
+    using Stored = K;
+    static constexpr unsigned kLanes = 32 / sizeof(K);
+
+    // bit i set if keys[i] < key, for the first min(valid, kLanes) keys
+    static unsigned lessMask(const K *keys, unsigned valid, const K &key) {
+        if constexpr (sizeof(K) == 4) {
+            auto load = _mm256_cmpgt_epi32(_mm256_set1_epi32(valid), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            __m256 less;
+            if constexpr (std::is_floating_point_v<K>) {
+                auto v = _mm256_maskload_ps(reinterpret_cast<const float *>(keys), load);
+                less = _mm256_cmp_ps(v, _mm256_set1_ps(key), _CMP_LT_OQ);
+            } else {
+                // signed compare only, so flip the sign bit of unsigned keys
+                constexpr uint32_t bias = std::is_signed_v<K> ? 0 : uint32_t(1) << 31;
+                auto v = _mm256_maskload_epi32(reinterpret_cast<const int *>(keys), load);
+                v = _mm256_xor_si256(v, _mm256_set1_epi32(int32_t(bias)));
+                auto x = _mm256_set1_epi32(int32_t(uint32_t(key) ^ bias));
+                less = _mm256_castsi256_ps(_mm256_cmpgt_epi32(x, v));
+            }
+            return _mm256_movemask_ps(_mm256_and_ps(less, _mm256_castsi256_ps(load)));
+        } else {
+            auto load = _mm256_cmpgt_epi64(_mm256_set1_epi64x(valid), _mm256_setr_epi64x(0, 1, 2, 3));
+            __m256d less;
+            if constexpr (std::is_floating_point_v<K>) {
+                auto v = _mm256_maskload_pd(reinterpret_cast<const double *>(keys), load);
+                less = _mm256_cmp_pd(v, _mm256_set1_pd(key), _CMP_LT_OQ);
+            } else {
+                constexpr uint64_t bias = std::is_signed_v<K> ? 0 : uint64_t(1) << 63;
+                auto v = _mm256_maskload_epi64(reinterpret_cast<const long long *>(keys), load);
+                v = _mm256_xor_si256(v, _mm256_set1_epi64x(int64_t(bias)));
+                auto x = _mm256_set1_epi64x(int64_t(uint64_t(key) ^ bias));
+                less = _mm256_castsi256_pd(_mm256_cmpgt_epi64(x, v));
+            }
+            return _mm256_movemask_pd(_mm256_and_pd(less, _mm256_castsi256_pd(load)));
+        }
+    }
+
+    template <unsigned N>
+    static unsigned locate(const K *keys, unsigned len, const K &key) {
+        unsigned cnt = 0;
+        for (unsigned i = 0; i < len; i += kLanes) {
+            cnt += __builtin_popcount(lessMask(keys + i, len - i, key));
+        }
+        return cnt;
+    }
+};
+#endif
+
+/**
+ * How keys of type K are stored in and searched within a node. Specialize it to change the
+ * node layout or search of a key type, e.g. by deriving from one of the searches above:
+ *   template <> struct BTreeKeyTraits<Foo, std::less<Foo>> : BranchlessSearch<Foo, std::less<Foo>> {};
+ * The default stores K as is and, going by `btree_bench -b search`, compares with SIMD where
+ * SimdSearch applies and scans linearly otherwise. Branchless binary search loses to both on
+ * random lookups because its chain of dependent loads stalls on every node not in L1.
+ */
+#ifdef __AVX2__
+template <typename K, typename Cmp>
+using BTreeDefaultSearch = std::conditional_t<std::is_arithmetic_v<K> && (sizeof(K) == 4 || sizeof(K) == 8) &&
+                                                  std::is_same_v<Cmp, std::less<K>>,
+                                              SimdSearch<K, Cmp>, LinearSearch<K, Cmp>>;
+#else
+template <typename K, typename Cmp>
+using BTreeDefaultSearch = LinearSearch<K, Cmp>;
+#endif
+
+template <typename K, typename Cmp>
+struct BTreeKeyTraits : BTreeDefaultSearch<K, Cmp> {};
+
+/**
+ * std::string with its first 8 bytes kept next to it as a big-endian integer (an abbreviated
+ * key). Comparing abbreviations orders strings like comparing the strings, except that equal
+ * abbreviations need a full compare, so most comparisons in a node never touch the characters
+ * (which live on the heap for strings past the SSO buffer).
+ */
+struct AbbrevString {
+    uint64_t abbrev{0};
+    std::string str;
+
+    static uint64_t abbreviate(const std::string &s) {
+        uint64_t ret = 0;
+        memcpy(&ret, s.data(), std::min<size_t>(sizeof(ret), s.size()));
+        return __builtin_bswap64(ret);
+    }
+
+    AbbrevString() = default;
+    AbbrevString(const std::string &s): abbrev(abbreviate(s)), str(s) {}
+    AbbrevString &operator=(const std::string &s) {
+        abbrev = abbreviate(s);
+        str = s;
+        return *this;
+    }
+    operator const std::string &() const { return str; }
+    friend std::ostream &operator<<(std::ostream &os, const AbbrevString &s) { return os << s.str; }
+};
+
+template <>
+struct BTreeKeyTraits<std::string, std::less<std::string>> {
+    using Stored = AbbrevString;
+
+    template <unsigned N>
+    static unsigned locate(const Stored *keys, unsigned len, const std::string &key) {
+        auto abbrev = AbbrevString::abbreviate(key);
+        unsigned i = 0;
+        while (i < len && (keys[i].abbrev < abbrev || (keys[i].abbrev == abbrev && keys[i].str < key))) {
+            i++;
+        }
+        return i;
+    }
+};
+
+/**
+ * Pointer-free static B+ tree (S+ tree) over a sorted key array, the search index behind the
+ * frozen layouts. Layer 0 holds all keys in sorted order, cut into cache-line sized blocks. Every
+ * upper layer holds, for each of its blocks, the smallest key of child subtrees 1..B, so the
+ * B + 1 children of block k are simply blocks k * (B + 1) .. k * (B + 1) + B of the layer below.
+ * A lookup scans one block per layer with a branchless rank and computes the next offset
+ * instead of loading it.
+ */
+template <typename K, typename Cmp = decltype(std::less<K>{})>
+class StaticSearchTree {
+public:
+    static constexpr unsigned B = std::max<unsigned>(2, 64 / sizeof(K));
+
+private:
+    struct alignas(64) Block {
+        K keys[B];
+    };
+
+    std::vector<Block> blocks;      // all layers, bottom layer first
+    std::vector<size_t> offsets;    // first block of each layer
+    size_t n{0};
+
+    static size_t blocksOf(size_t n) { return (n + B - 1) / B; }
+    // number of keys (padding included) in the layer above a layer of n keys
+    static size_t parentKeys(size_t n) { return (blocksOf(n) + B) / (B + 1) * B; }
+
+    // number of keys in the block that are less than key
+    static unsigned rank(const Block &block, const K &key) {
+#ifdef __AVX2__
+        if constexpr (std::is_integral_v<K> && std::is_same_v<Cmp, std::less<K>> &&
+                      (sizeof(K) == 4 || sizeof(K) == 8)) {
+            // signed compare only, so flip the sign bit of unsigned keys
+            constexpr K bias = std::is_signed_v<K> ? K(0) : K(K(1) << (sizeof(K) * 8 - 1));
+            unsigned cnt = 0;
+            for (unsigned i = 0; i < B; i += 32 / sizeof(K)) {
+                auto v = _mm256_load_si256(reinterpret_cast<const __m256i *>(block.keys + i));
+                if constexpr (sizeof(K) == 4) {
+                    auto x = _mm256_set1_epi32(int32_t(key ^ bias));
+                    v = _mm256_xor_si256(v, _mm256_set1_epi32(int32_t(bias)));
+                    auto m = _mm256_cmpgt_epi32(x, v);
+                    cnt += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+                } else {
+                    auto x = _mm256_set1_epi64x(int64_t(key ^ bias));
+                    v = _mm256_xor_si256(v, _mm256_set1_epi64x(int64_t(bias)));
+                    auto m = _mm256_cmpgt_epi64(x, v);
+                    cnt += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+                }
+            }
+            return cnt;
+        }
+#endif
+        unsigned cnt = 0;
+        for (unsigned i = 0; i < B; i++) {
+            cnt += Cmp()(block.keys[i], key);
+        }
+        return cnt;
+    }
+
+public:
+    StaticSearchTree() = default;
+
+    // keys must be sorted w.r.t. Cmp
+    explicit StaticSearchTree(const std::vector<K> &keys): n(keys.size()) {
+        if (n == 0) {
+            return;
+        }
+        const K &pad = keys.back();
+
+        size_t total = 0;
+        for (size_t layer = n; ; layer = parentKeys(layer)) {
+            offsets.push_back(total);
+            total += blocksOf(layer);
+            if (layer <= B) {
+                break;
+            }
+        }
+        blocks.resize(total);
+
+        for (size_t i = 0; i < blocksOf(n) * B; i++) {
+            blocks[i / B].keys[i % B] = i < n ? keys[i] : pad;
+        }
+        for (size_t h = 1; h < offsets.size(); h++) {
+            size_t layerKeys = (h + 1 < offsets.size() ? offsets[h + 1] : total) - offsets[h];
+            layerKeys *= B;
+            for (size_t i = 0; i < layerKeys; i++) {
+                // key j of block k is the first key of child j + 1, found by going leftmost down
+                size_t k = i / B * (B + 1) + i % B + 1;
+                for (size_t l = 1; l < h; l++) {
+                    k *= B + 1;
+                }
+                blocks[offsets[h] + i / B].keys[i % B] = k * B < n ? keys[k * B] : pad;
+            }
+        }
+    }
+
+    // Index of the first key not less than key, size() if there is none. prefetch(i) is called
+    // with the first index of the bottom block before it is scanned, to overlap a dependent miss.
+    template <typename Prefetch>
+    size_t lowerBound(const K &key, Prefetch prefetch) const {
+        // with this early out, padding (copies of the largest key) is never counted by rank
+        if (n == 0 || Cmp()(at(n - 1), key)) {
+            return n;
+        }
+        size_t k = 0;
+        for (size_t h = offsets.size() - 1; h > 0; h--) {
+            k = k * (B + 1) + rank(blocks[offsets[h] + k], key);
+        }
+        prefetch(k * B);
+        return k * B + rank(blocks[k], key);
+    }
+
+    size_t lowerBound(const K &key) const {
+        return lowerBound(key, [](size_t) {});
+    }
+
+    const K &at(size_t idx) const {
+        return blocks[idx / B].keys[idx % B];
+    }
+
+    size_t size() const {
+        return n;
+    }
+
+    size_t bytes() const {
+        return blocks.size() * sizeof(Block);
+    }
+};
+
+/**
+ * Immutable snapshot of a BTree: a StaticSearchTree over the keys plus the values in key order.
+ */
+template <typename K, typename V, typename Cmp = decltype(std::less<K>{})>
+class FrozenBTree {
+public:
+    struct FrozenCursor {
+        const K *k{nullptr};
+        const V *v{nullptr};
+        bool valid() const { return k; }
+        const K &key() const { assert(k); return *k; }
+        const V &val() const { assert(v); return *v; }
+    };
+
+private:
+    StaticSearchTree<K, Cmp> index;
+    std::vector<V> vals;            // parallel to the bottom layer of index
+
+    size_t lowerBoundIdx(const K &key) const {
+        // the value is the other miss of a lookup, overlap it with the last block scan
+        return index.lowerBound(key, [this](size_t i) {
+            __builtin_prefetch(vals.data() + std::min(i, vals.size() - 1));
+        });
+    }
+
+    FrozenCursor cursorAt(size_t idx) const {
+        if (idx >= vals.size()) {
+            return {};
+        }
+        return {&index.at(idx), &vals[idx]};
+    }
+
+public:
+    FrozenBTree() = default;
+
+    // keys must be sorted w.r.t. Cmp, vals is parallel to keys
+    FrozenBTree(const std::vector<K> &keys, std::vector<V> values): index(keys), vals(std::move(values)) {
+        assert(keys.size() == vals.size());
+    }
+
+    FrozenCursor lower_bound(const K &key) const {
+        return cursorAt(lowerBoundIdx(key));
+    }
+
+    FrozenCursor find(const K &key) const {
+        auto idx = lowerBoundIdx(key);
+        if (idx < vals.size() && !Cmp()(key, index.at(idx))) {
+            return cursorAt(idx);
+        }
+        return {};
+    }
+
+    size_t size() const {
+        return vals.size();
+    }
+
+    size_t bytes() const {
+        return index.bytes() + vals.size() * sizeof(V);
+    }
+};
+
+/**
+ * FrozenBTree for integer keys with frame-of-reference compressed leaves. Keys are greedily cut
+ * into 64-byte leaf blocks, each storing its smallest key as base and the deltas of up to 48
+ * keys at the narrowest byte width (1, 2, 4 or 8 bytes) that fits the run, so clustered keys
+ * take 2-8x less space than plain keys. The block bases are indexed by a StaticSearchTree, and
+ * a leaf is searched in the compressed domain: the query becomes a delta, and lanes less than
+ * it are counted with one SIMD compare over the block.
+ *
+ * A leaf names its first key by a 32-bit index to keep the block within a cache line, so at
+ * most kMaxKeys (2^32 - 1) keys fit; the constructor throws std::length_error beyond that.
+ */
+template <typename K, typename V>
+class CompressedFrozenBTree {
+    static_assert(std::is_integral_v<K> && sizeof(K) >= 4, "frame-of-reference leaves need 32 or 64-bit integer keys");
+    using U = std::make_unsigned_t<K>;
+
+    static constexpr unsigned kPayload = 48;
+
+    struct alignas(64) Leaf {
+        uint8_t payload[kPayload]; // deltas to base, unused lanes are all ones
+        K base;
+        uint32_t first;            // index of the first key in the block
+        uint8_t width;             // bytes per delta
+        uint8_t len;
+    };
+    static_assert(sizeof(Leaf) == 64, "leaf block must be a cache line");
+
+public:
+    static constexpr size_t kMaxKeys = std::numeric_limits<uint32_t>::max();
+
+    struct CompressedCursor {
+        K k{};
+        const V *v{nullptr};
+        bool valid() const { return v; }
+        const K &key() const { assert(v); return k; }
+        const V &val() const { assert(v); return *v; }
+    };
+
+private:
+    StaticSearchTree<K> index;      // over the leaf bases
+    std::vector<Leaf> leaves;
+    std::vector<V> vals;
+
+    template <typename T>
+    static T delta(const Leaf &leaf, unsigned i) {
+        T ret;
+        memcpy(&ret, leaf.payload + i * sizeof(T), sizeof(T));
+        return ret;
+    }
+
+    template <typename T>
+    static unsigned countLess(const Leaf &leaf, T t) {
+#ifdef __AVX2__
+        // signed compares only, flip the sign bits; unused lanes are all ones and never less
+        auto bias = [](auto v) {
+            if constexpr (sizeof(T) == 1) return _mm256_xor_si256(v, _mm256_set1_epi8(char(0x80)));
+            else if constexpr (sizeof(T) == 2) return _mm256_xor_si256(v, _mm256_set1_epi16(short(0x8000)));
+            else if constexpr (sizeof(T) == 4) return _mm256_xor_si256(v, _mm256_set1_epi32(int(0x80000000)));
+            else return _mm256_xor_si256(v, _mm256_set1_epi64x((long long)(1ULL << 63)));
+        };
+        __m256i x;
+        if constexpr (sizeof(T) == 1) x = _mm256_set1_epi8(char(t));
+        else if constexpr (sizeof(T) == 2) x = _mm256_set1_epi16(short(t));
+        else if constexpr (sizeof(T) == 4) x = _mm256_set1_epi32(int(t));
+        else x = _mm256_set1_epi64x((long long)t);
+        x = bias(x);
+        auto lo = bias(_mm256_load_si256(reinterpret_cast<const __m256i *>(leaf.payload)));
+        // the upper 16 bytes, the rest of the lane is the header and masked out below
+        auto hi = bias(_mm256_load_si256(reinterpret_cast<const __m256i *>(leaf.payload + 32)));
+        __m256i mlo, mhi;
+        if constexpr (sizeof(T) == 1) { mlo = _mm256_cmpgt_epi8(x, lo); mhi = _mm256_cmpgt_epi8(x, hi); }
+        else if constexpr (sizeof(T) == 2) { mlo = _mm256_cmpgt_epi16(x, lo); mhi = _mm256_cmpgt_epi16(x, hi); }
+        else if constexpr (sizeof(T) == 4) { mlo = _mm256_cmpgt_epi32(x, lo); mhi = _mm256_cmpgt_epi32(x, hi); }
+        else { mlo = _mm256_cmpgt_epi64(x, lo); mhi = _mm256_cmpgt_epi64(x, hi); }
+        unsigned bits = __builtin_popcount(uint32_t(_mm256_movemask_epi8(mlo))) +
+                        __builtin_popcount(uint32_t(_mm256_movemask_epi8(mhi)) & 0xffffU);
+        return bits / sizeof(T);
+#else
+        unsigned cnt = 0;
+        for (unsigned i = 0; i < kPayload / sizeof(T); i++) {
+            cnt += delta<T>(leaf, i) < t;
+        }
+        return cnt;
+#endif
+    }
+
+    // number of keys in the leaf that are less than key
+    static unsigned rank(const Leaf &leaf, const K &key) {
+        if (key < leaf.base) {
+            return 0;
+        }
+        U t = U(key) - U(leaf.base);
+        switch (leaf.width) {
+        case 1: return t > 0xff ? leaf.len : countLess<uint8_t>(leaf, uint8_t(t));
+        case 2: return t > 0xffff ? leaf.len : countLess<uint16_t>(leaf, uint16_t(t));
+        case 4: return t > 0xffffffffULL ? leaf.len : countLess<uint32_t>(leaf, uint32_t(t));
+        default: return countLess<uint64_t>(leaf, uint64_t(t));
+        }
+    }
+
+    K keyAt(const Leaf &leaf, unsigned i) const {
+        U d;
+        switch (leaf.width) {
+        case 1: d = delta<uint8_t>(leaf, i); break;
+        case 2: d = delta<uint16_t>(leaf, i); break;
+        case 4: d = delta<uint32_t>(leaf, i); break;
+        default: d = delta<uint64_t>(leaf, i); break;
+        }
+        return K(U(leaf.base) + d);
+    }
+
+    CompressedCursor lowerBoundCursor(const K &key) const {
+        if (leaves.empty()) {
+            return {};
+        }
+        // the answer is in the last leaf starting below key, or it is the first key of the next
+        size_t j = index.lowerBound(key);
+        j = j ? j - 1 : 0;
+        auto &leaf = leaves[j];
+        unsigned r = rank(leaf, key);
+        if (r == leaf.len) {
+            if (j + 1 == leaves.size()) {
+                return {};
+            }
+            return {leaves[j + 1].base, &vals[leaves[j + 1].first]};
+        }
+        return {keyAt(leaf, r), &vals[leaf.first + r]};
+    }
+
+public:
+    CompressedFrozenBTree() = default;
+
+    // keys must be sorted ascending, vals is parallel to keys
+    CompressedFrozenBTree(const std::vector<K> &keys, std::vector<V> values): vals(std::move(values)) {
+        assert(keys.size() == vals.size());
+        if (keys.size() > kMaxKeys) {
+            throw std::length_error("CompressedFrozenBTree holds at most 2^32 - 1 keys");
+        }
+        std::vector<K> bases;
+        for (size_t i = 0; i < keys.size();) {
+            // the widest run wins, ties go to the narrower width
+            unsigned width = 0, len = 0;
+            for (unsigned w = 1; w <= sizeof(K); w *= 2) {
+                U limit = w == sizeof(U) ? ~U(0) : U((U(1) << (w * 8)) - 1);
+                unsigned l = 0;
+                // all-ones is the lane filler, keep it out of the data
+                while (l < kPayload / w && i + l < keys.size() && U(U(keys[i + l]) - U(keys[i])) < limit) {
+                    l++;
+                }
+                if (l > len) {
+                    width = w;
+                    len = l;
+                }
+            }
+            Leaf leaf;
+            memset(leaf.payload, 0xff, kPayload);
+            leaf.base = keys[i];
+            leaf.first = uint32_t(i);
+            leaf.width = width;
+            leaf.len = len;
+            for (unsigned l = 0; l < len; l++) {
+                U d = U(keys[i + l]) - U(keys[i]);
+                memcpy(leaf.payload + l * width, &d, width); // little endian
+            }
+            leaves.push_back(leaf);
+            bases.push_back(keys[i]);
+            i += len;
+        }
+        index = StaticSearchTree<K>(bases);
+    }
+
+    CompressedCursor lower_bound(const K &key) const {
+        return lowerBoundCursor(key);
+    }
+
+    CompressedCursor find(const K &key) const {
+        auto cur = lowerBoundCursor(key);
+        if (cur.valid() && cur.key() == key) {
+            return cur;
+        }
+        return {};
+    }
+
+    size_t size() const {
+        return vals.size();
+    }
+
+    size_t bytes() const {
+        return index.bytes() + leaves.size() * sizeof(Leaf) + vals.size() * sizeof(V);
+    }
+};
+
+/**
+ * Blocked Bloom filter: every key sets (and probes) one bit in each of the 8 words of a single
+ * cache-line sized block, so a query costs one cache miss regardless of the number of probes.
+ * Takes pre-mixed 64-bit hashes; the upper half picks the block, the lower half the bits.
+ */
+class BlockedBloomFilter {
+    struct alignas(64) Block {
+        uint64_t words[8]{};
+    };
+    std::vector<Block> blocks;
+
+    size_t blockIdx(uint64_t h) const { return (h >> 32) * blocks.size() >> 32; }
+
+    static uint64_t bit(uint64_t h, unsigned i) {
+        constexpr uint32_t salt[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                      0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+        return uint64_t(1) << (uint32_t(uint32_t(h) * salt[i]) >> 26);
+    }
+
+public:
+    BlockedBloomFilter(size_t keys, unsigned bitsPerKey): blocks(std::max<size_t>(1, (keys * bitsPerKey + 511) / 512)) {}
+
+    void add(uint64_t h) {
+        auto &b = blocks[blockIdx(h)];
+        for (unsigned i = 0; i < 8; i++) {
+            b.words[i] |= bit(h, i);
+        }
+    }
+
+    bool mayContain(uint64_t h) const {
+        auto &b = blocks[blockIdx(h)];
+        bool ret = true;
+        for (unsigned i = 0; i < 8; i++) {
+            ret &= (b.words[i] & bit(h, i)) != 0;
+        }
+        return ret;
+    }
+};
+
+/**
+ * Whether values of type V live out of line in a per-tree slab, with nodes holding a pointer to
+ * them. Pays off once inline values would spread a node over many cache lines and make every
+ * shift in a node move whole values. Specialize to override for a value type.
+ */
+template <typename V>
+struct BTreeValueTraits {
+    static constexpr bool separate = sizeof(V) > 64;
+};
+
+// node slot of an out-of-line value
+template <typename V>
+struct ValueHandle {
+    V *ptr{nullptr};
+    operator V &() const { return *ptr; }
+    friend std::ostream &operator<<(std::ostream &os, const ValueHandle &h) { return os << *h.ptr; }
+};
+
+/**
+ * Stable storage for out-of-line values: chunks of slots, freed slots are reused through an
+ * intrusive free list. A value is constructed once and never moved afterwards.
+ */
+template <typename V>
+class ValueSlab {
+public:
+    union Slot {
+        Slot *next;
+        V val;
+        Slot() {}
+        ~Slot() {}
+    };
+
+private:
+    static constexpr size_t kChunkSlots = 64;
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot *freeList{nullptr};
+    Slot *cur{nullptr};
+    Slot *curEnd{nullptr};
+
+public:
+    V *create(const V &val) {
+        Slot *slot;
+        if (freeList) {
+            slot = freeList;
+            freeList = slot->next;
+        } else {
+            if (cur == curEnd) {
+                chunks.emplace_back(new Slot[kChunkSlots]);
+                cur = chunks.back().get();
+                curEnd = cur + kChunkSlots;
+            }
+            slot = cur++;
+        }
+        return new (&slot->val) V(val);
+    }
+
+    void destroy(V *val) {
+        val->~V();
+        auto slot = reinterpret_cast<Slot *>(val);
+        slot->next = freeList;
+        freeList = slot;
+    }
+
+    // n contiguous unconstructed slots, to be filled with placement new (from any thread)
+    Slot *allocRange(size_t n) {
+        chunks.emplace_back(new Slot[n]);
+        return chunks.back().get();
+    }
+
+    // drop all storage, live values have to be destroyed by the owner first
+    void reset() {
+        chunks.clear();
+        freeList = cur = curEnd = nullptr;
+    }
+};
+
+#ifdef BTREE_NODE_ARENA
+/**
+ * Process-wide arena holding the nodes of every tree, so that a node can be named by a 32-bit
+ * index (in kUnit steps from base) instead of a pointer. Address space for all 2^32 units is
+ * reserved up front and committed in kCommitStep pieces as the arena grows; freed blocks go to a
+ * free list per size. Index 0 is never handed out and stands for null.
+ *
+ * The arena is shared by all threads, so each thread caches free blocks of every size and goes
+ * to the locked shared lists only to refill or flush about kBatchBytes of blocks at a time.
+ * Trees built or changed on different threads then rarely meet on the lock.
+ */
+class BTreeNodeArena {
+public:
+    static constexpr size_t kUnit = 16;
+    static constexpr size_t kMaxUnits = 1024;
+
+private:
+    static constexpr size_t kReserve = kUnit << 32;
+    static constexpr size_t kCommitStep = 2 << 20;
+
+    // all constant initialized, a tree may well be a global itself
+    static inline char *base = nullptr;
+    static inline size_t top = 1;
+    static inline size_t committed = 0;
+    static inline uint32_t freeLists[kMaxUnits + 1] = {};
+    static inline std::mutex mtx;
+
+    static constexpr size_t kBatchBytes = 16 << 10;
+
+    // free blocks of this thread, linked like the shared lists
+    struct Cache {
+        uint32_t heads[kMaxUnits + 1];
+        uint32_t counts[kMaxUnits + 1];
+        bool exited;
+    };
+    // trivially destructible, so still usable by trees destroyed after the thread's flusher
+    static inline thread_local Cache cache = {};
+
+    // gives the cached blocks back when the thread exits, later frees bypass the cache
+    struct CacheFlusher {
+        ~CacheFlusher() {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (size_t units = 1; units <= kMaxUnits; units++) {
+                while (auto idx = cache.heads[units]) {
+                    cache.heads[units] = next(idx);
+                    pushShared(idx, units);
+                }
+                cache.counts[units] = 0;
+            }
+            cache.exited = true;
+        }
+    };
+    static inline thread_local CacheFlusher flusher;
+
+    static size_t batch(size_t units) {
+        return std::max<size_t>(1, kBatchBytes / (units * kUnit));
+    }
+
+    static uint32_t &next(uint32_t idx) {
+        return *static_cast<uint32_t *>(fromIdx(idx));
+    }
+
+    static void pushShared(uint32_t idx, size_t units) {
+        next(idx) = freeLists[units];
+        freeLists[units] = idx;
+    }
+
+    // one batch of blocks into the empty cache list of units, from the shared list or fresh;
+    // a single block once the thread's flusher is gone
+    static void refill(size_t units) {
+        size_t n = 1;
+        if (!cache.exited) {
+            // touched first so that the flusher is registered before anything is cached
+            (void)&flusher;
+            n = batch(units);
+        }
+        std::lock_guard<std::mutex> lk(mtx);
+        size_t got = 0;
+        for (; got < n && freeLists[units]; got++) {
+            auto idx = freeLists[units];
+            freeLists[units] = next(idx);
+            next(idx) = cache.heads[units];
+            cache.heads[units] = idx;
+        }
+        if (got == 0) {
+            if ((top + n * units) * kUnit > committed) {
+                grow((top + n * units) * kUnit);
+            }
+            // linked back to front, so that blocks are handed out in address order
+            for (size_t i = n; i-- > 0;) {
+                auto idx = uint32_t(top + i * units);
+                next(idx) = cache.heads[units];
+                cache.heads[units] = idx;
+            }
+            top += n * units;
+            got = n;
+        }
+        cache.counts[units] += got;
+    }
+
+#ifdef BTREE_HUGEPAGE
+    static inline bool hugetlb = true;
+#endif
+
+    static void grow(size_t bytes) {
+        if (!base) {
+            // one step extra, so that base and every commit sit on a huge page boundary
+            auto p = mmap(nullptr, kReserve + kCommitStep, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            base = reinterpret_cast<char *>((uintptr_t(p) + kCommitStep - 1) & ~(kCommitStep - 1));
+        }
+        auto step = (bytes - committed + kCommitStep - 1) / kCommitStep * kCommitStep;
+        if (committed + step > kReserve) {
+            throw std::bad_alloc();
+        }
+        auto at = base + committed;
+#ifdef BTREE_HUGEPAGE
+        constexpr int kFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+        if (hugetlb && mmap(at, step, PROT_READ | PROT_WRITE, kFlags | MAP_HUGETLB, -1, 0) == MAP_FAILED) {
+            // out of reserved huge pages, don't ask again
+            hugetlb = false;
+        }
+        if (!hugetlb) {
+            // a failed MAP_FIXED may have dropped the reservation, map over whatever is left
+            if (mmap(at, step, PROT_READ | PROT_WRITE, kFlags, -1, 0) == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            madvise(at, step, MADV_HUGEPAGE);
+        }
+#else
+        if (mprotect(at, step, PROT_READ | PROT_WRITE) != 0) {
+            throw std::bad_alloc();
+        }
+#endif
+        committed += step;
+    }
+
+public:
+    static void *alloc(size_t bytes) {
+        auto units = (bytes + kUnit - 1) / kUnit;
+        assert(units <= kMaxUnits);
+        if (!cache.heads[units]) {
+            refill(units);
+        }
+        auto idx = cache.heads[units];
+        cache.heads[units] = next(idx);
+        cache.counts[units]--;
+        return fromIdx(idx);
+    }
+
+    static void free(void *p, size_t bytes) {
+        auto units = (bytes + kUnit - 1) / kUnit;
+        auto idx = toIdx(p);
+        if (cache.exited) {
+            std::lock_guard<std::mutex> lk(mtx);
+            pushShared(idx, units);
+            return;
+        }
+        next(idx) = cache.heads[units];
+        cache.heads[units] = idx;
+        // keep one batch around for allocations to come, flush the one before
+        if (++cache.counts[units] >= 2 * batch(units)) {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (auto n = batch(units); n > 0; n--) {
+                idx = cache.heads[units];
+                cache.heads[units] = next(idx);
+                pushShared(idx, units);
+            }
+            cache.counts[units] -= batch(units);
+        }
+    }
+
+    static uint32_t toIdx(const void *p) {
+        return uint32_t((static_cast<const char *>(p) - base) / kUnit);
+    }
+
+    static void *fromIdx(uint32_t idx) {
+        return base + size_t(idx) * kUnit;
+    }
+};
+#endif
+
+// link to a node: a plain pointer, or an arena index with BTREE_COMPACT_NODES
+template <typename T>
+class BTreeNodeRef {
+#ifdef BTREE_COMPACT_NODES
+    uint32_t idx{0};
+public:
+    BTreeNodeRef(T *p = nullptr): idx(p ? BTreeNodeArena::toIdx(p) : 0) {}
+    T *get() const { return idx ? &**this : nullptr; }
+    T &operator*() const { return *static_cast<T *>(BTreeNodeArena::fromIdx(idx)); }
+#else
+    T *ptr{nullptr};
+public:
+    BTreeNodeRef(T *p = nullptr): ptr(p) {}
+    T *get() const { return ptr; }
+    T &operator*() const { return *ptr; }
+#endif
+    operator T *() const { return get(); }
+    T *operator->() const { return &**this; }
+};
+
+// shape and memory of a tree at one point in time, see BTree::stats()
+struct BTreeStats {
+    unsigned height{0};
+    std::vector<size_t> levelNodes; // root level first
+    size_t entries{0};
+    double avgFill{0};  // entries over entry slots of all nodes
+    double minFill{0};  // of the emptiest node, the root only counts when it is the only one
+    size_t bytesUsed{0};      // entries and child links in use
+    size_t bytesAllocated{0}; // nodes as allocated
+    // since construction
+    uint64_t splits{0};
+    uint64_t merges{0};
+    uint64_t borrows{0};
+
+    friend std::ostream &operator<<(std::ostream &os, const BTreeStats &st) {
+        os << "height " << st.height << ", nodes per level";
+        for (auto n : st.levelNodes) {
+            os << ' ' << n;
+        }
+        os << ", " << st.entries << " entries, fill avg " << st.avgFill << " min " << st.minFill << ", "
+           << st.bytesUsed << '/' << st.bytesAllocated << " bytes used, " << st.splits << " splits, "
+           << st.merges << " merges, " << st.borrows << " borrows";
+        return os;
+    }
+};
+
 BTREE_TPL class BTree {
     static_assert(ORDER >= 3, "ORDER must be at least 3");
 
+    using KeyTraits = BTreeKeyTraits<K, Cmp>;
+    static constexpr bool kSeparateVals = BTreeValueTraits<V>::separate;
+    using StoredVal = std::conditional_t<kSeparateVals, ValueHandle<V>, V>;
+    using Slot = typename ValueSlab<V>::Slot;
+    struct NoSlab {};
+    static constexpr bool kNothrowMove = std::is_nothrow_move_assignable_v<typename KeyTraits::Stored> &&
+                                         std::is_nothrow_move_assignable_v<StoredVal>;
+
     struct BTreeNode;
 
     struct BTreeLeaf {
         bool isLeaf;
         static_assert(std::numeric_limits<uint8_t>::max() >= ORDER - 1, "ORDER is too large for uint8_t");
         uint8_t len{0};
-        BTreeNode *parent{nullptr};
-        K keys[ORDER - 1];
-        V vals[ORDER - 1];
+        BTreeNodeRef<BTreeNode> parent;
+        typename KeyTraits::Stored keys[ORDER - 1];
+        StoredVal vals[ORDER - 1];
         BTreeLeaf(bool isLeaf = true, BTreeNode *parent = nullptr): isLeaf(isLeaf), parent(parent) {}
         unsigned locate(const K &key) const {
-            // in our scenario, a linear search is a tad faster than binary search
-            // return std::lower_bound(keys, keys + len, key, Cmp()) - keys;
-            return std::find_if(keys, keys + len, [&key](const K &k) {
-                return !Cmp()(k, key);
-            }) - keys;
+            return KeyTraits::template locate<ORDER - 1>(keys, len, key);
         }
     };
 
     struct BTreeNodePtr {
-        BTreeLeaf *ptr;
+        BTreeNodeRef<BTreeLeaf> ptr;
         BTreeNodePtr(BTreeLeaf *ptr = nullptr): ptr(ptr) {}
         BTreeNodePtr &operator=(const BTreeNodePtr &other) { ptr = other.ptr; return *this; }
-        operator bool() const { return ptr != nullptr; }
-        bool operator==(const BTreeNodePtr &other) const { return ptr == other.ptr; }
-        BTreeLeaf *operator->(void) const { return static_cast<BTreeLeaf *>(ptr); }
+        operator bool() const { return ptr.get() != nullptr; }
+        bool operator==(const BTreeNodePtr &other) const { return ptr.get() == other.ptr.get(); }
+        BTreeLeaf *operator->(void) const { return &*ptr; }
         bool isLeaf() const { return ptr->isLeaf; }
         BTreeLeaf &leaf() {
             assert(isLeaf());
-            return *static_cast<BTreeLeaf *>(ptr); 
+            return *ptr; 
         }
         BTreeNode &node() {
             assert(!isLeaf());
-            return *static_cast<BTreeNode *>(ptr); 
+            return *static_cast<BTreeNode *>(&*ptr); 
         }
         BTreeNodePtr *children() {
             assert(!isLeaf());
-            return static_cast<BTreeNode *>(ptr)->children; 
+            return static_cast<BTreeNode *>(&*ptr)->children; 
         }
+        // free a node unlinked from a live tree, inner nodes have to be emptied first
         void destruct() {
             if (!ptr) {
                 return;
             }
             if (isLeaf()) {
-                delete static_cast<BTreeLeaf *>(ptr);
+                deleteNode(ptr.get());
+            } else {
+                assert(ptr->len == 0);
+                deleteNode(static_cast<BTreeNode *>(ptr.get()));
+            }
+            ptr = nullptr;
+        }
+        // free the node and everything below it right away, for trees no reader can be on
+        void destructTree() {
+            if (!ptr) {
+                return;
+            }
+            if (isLeaf()) {
+                freeNode(ptr.get());
             } else {
-                delete static_cast<BTreeNode *>(ptr);
+                freeNode(static_cast<BTreeNode *>(ptr.get()));
             }
             ptr = nullptr;
         }
@@ -90,12 +1079,43 @@ BTREE_TPL class BTree {
                 return;
             }
             for(int i = 0; i < len + 1; i++) {
-                children[i].destruct();
+                children[i].destructTree();
             }
         }
         BTreeNode(BTreeNode *parent = nullptr): BTreeLeaf(false, parent) {}
     };
 
+    template <typename T>
+    static T *newNode() {
+#ifdef BTREE_NODE_ARENA
+        static_assert(sizeof(T) <= BTreeNodeArena::kUnit * BTreeNodeArena::kMaxUnits, "node too large for the arena");
+        static_assert(alignof(T) <= BTreeNodeArena::kUnit, "node alignment too large for the arena");
+        return new (BTreeNodeArena::alloc(sizeof(T))) T;
+#else
+        return new T;
+#endif
+    }
+
+    template <typename T>
+    static void freeNode(T *node) {
+#ifdef BTREE_NODE_ARENA
+        node->~T();
+        BTreeNodeArena::free(node, sizeof(T));
+#else
+        delete node;
+#endif
+    }
+
+    template <typename T>
+    static void deleteNode(T *node) {
+#ifdef BTREE_EBR
+        // readers inside an ebr::Guard may still be on it
+        ebr::retire(node, [](void *p) { freeNode(static_cast<T *>(p)); });
+#else
+        freeNode(node);
+#endif
+    }
+
     struct BTreeCursor {
         BTreeNodePtr node;
         unsigned idx{0};
@@ -125,6 +1145,32 @@ BTREE_TPL class BTree {
         return {cur, 0};
     }
 
+    // `at` is a preallocated slab slot for out-of-line values, so that builders running
+    // concurrently never touch the slab itself
+    void storeVal(StoredVal &slot, const V &val, Slot *at = nullptr) {
+        if constexpr (kSeparateVals) {
+            slot.ptr = at ? new (&at->val) V(val) : slab.create(val);
+        } else {
+            slot = val;
+        }
+    }
+
+    // not retired under BTREE_EBR, the slab goes with the tree while retirees may outlive it
+    void releaseVal(StoredVal &slot) {
+        if constexpr (kSeparateVals) {
+            slab.destroy(slot.ptr);
+        }
+    }
+
+    void releaseAllVals() {
+        if constexpr (kSeparateVals) {
+            if constexpr (!std::is_trivially_destructible_v<V>) {
+                for_each([](const K &, const V &v) { v.~V(); });
+            }
+            slab.reset();
+        }
+    }
+
     void printNode(const BTreeLeaf *leaf) {
         dbg << "l" << std::hex << (uintptr_t(leaf) & 0xffff) << std::dec << "(" << leaf->len << "): ";
         for(int i = 0; i < leaf->len; i++) {
@@ -139,7 +1185,7 @@ BTREE_TPL class BTree {
             dbg << node->keys[i] << ',' << node->vals[i] << " ";
         }
         for(int i = 0; i < node->len + 1; i++) {
-            dbg << std::hex << (uintptr_t(node->children[i].ptr) & 0xffff) << std::dec << '(' << node->children[i]->len << ") ";
+            dbg << std::hex << (uintptr_t(node->children[i].ptr.get()) & 0xffff) << std::dec << '(' << node->children[i]->len << ") ";
         }
         dbg << std::endl;
     }
@@ -187,6 +1233,11 @@ BTREE_TPL class BTree {
         if (!sibling.isLeaf()) {
             sibling.children()[0] = nullptr;
         }
+        if (sibling == rightmost) {
+            rightmost = child;
+        }
+        merges++;
+        BTREE_COUNT(btreeMerges);
         // Destruct sibling
         sibling.destruct();
 
@@ -198,6 +1249,7 @@ BTREE_TPL class BTree {
         dbg << "remove #" << idx << "(" << node->keys[idx] << ") from ";
         printNode(node);
         assert(idx < node->len);
+        releaseVal(node->vals[idx]);
         std::move(node->keys + idx + 1, node->keys + node->len, node->keys + idx);
         std::move(node->vals + idx + 1, node->vals + node->len, node->vals + idx);
         node->len--;
@@ -211,27 +1263,23 @@ BTREE_TPL class BTree {
     void removeFromNonLeaf(BTreeNode *node, unsigned idx) {
         dbg << "remove #" << idx << "(" << node->keys[idx] << ") from ";
         printNode(node);
+        // The predecessor (successor) is removed by descending to it like any other key, so that
+        // every node on the way is filled first. node itself is not touched on the way down,
+        // its key can serve as the key to remove.
         if (node->children[idx]->len >= ORDER / 2) {
             auto pred = getPredecessor(node, idx);
             assert(pred.valid());
             node->keys[idx] = pred.key();
-            node->vals[idx] = pred.val();
-            if (pred.node.isLeaf()) {
-                removeFromLeaf(&pred.node.leaf(), pred.idx);
-            } else {
-                removeFromNonLeaf(&pred.node.node(), pred.idx);
-            }
+            // the removed value goes down in place of the predecessor's, to be released there
+            std::swap(node->vals[idx], pred.node->vals[pred.idx]);
+            doRemove(node->children[idx], node->keys[idx]);
         } else if (node->children[idx + 1]->len >= ORDER / 2) {
             auto succ = getSuccessor(node, idx);
             assert(succ.valid());
             node->keys[idx] = succ.key();
-            node->vals[idx] = succ.val();
+            std::swap(node->vals[idx], succ.node->vals[succ.idx]);
             dbg << "succ key: " << succ.key() << std::endl;
-            if (succ.node.isLeaf()) {
-                removeFromLeaf(&succ.node.leaf(), succ.idx);
-            } else {
-                removeFromNonLeaf(&succ.node.node(), succ.idx);
-            }
+            doRemove(node->children[idx + 1], node->keys[idx]);
         } else {
             auto key = node->keys[idx];
             merge(node, idx);
@@ -245,13 +1293,13 @@ BTREE_TPL class BTree {
             std::move_backward(node->keys + idx, node->keys + node->len, node->keys + node->len + 1);
             std::move_backward(node->vals + idx, node->vals + node->len, node->vals + node->len + 1);
             node->keys[idx] = key;
-            node->vals[idx] = val;
+            storeVal(node->vals[idx], val);
             node->len++;
         } else {
             auto idx = node->locate(key);
             if (node.children()[idx]->len == ORDER - 1) {
                 splitChild(&node.node(), idx);
-                if (key > node->keys[idx]) {
+                if (Cmp()(node->keys[idx], key)) {
                     idx++;
                 }
             }
@@ -263,7 +1311,7 @@ BTREE_TPL class BTree {
         auto child = parent->children[idx];
         assert(child->len == ORDER - 1);
         // Create new child
-        BTreeNodePtr newChild(child->isLeaf ? new BTreeLeaf : new BTreeNode);
+        BTreeNodePtr newChild(child->isLeaf ? newNode<BTreeLeaf>() : newNode<BTreeNode>());
         newChild->parent = parent;
 
         // Move upper half of keys and values to newChild
@@ -276,6 +1324,11 @@ BTREE_TPL class BTree {
             }
         }
         newChild->len = ORDER - 1 - ORDER / 2;
+        splits++;
+        BTREE_COUNT(btreeSplits);
+        if (child == rightmost) {
+            rightmost = newChild;
+        }
 
         // Insert middle key and value into parent
         std::move_backward(parent->keys + idx, parent->keys + parent->len, parent->keys + parent->len + 1);
@@ -311,6 +1364,8 @@ BTREE_TPL class BTree {
         // Update lengths
         child->len++;
         sibling->len--;
+        borrows++;
+        BTREE_COUNT(btreeBorrows);
     }
 
     void borrowFromNext(BTreeNode *node, unsigned idx) {
@@ -335,6 +1390,8 @@ BTREE_TPL class BTree {
         // Update lengths
         child->len++;
         sibling->len--;
+        borrows++;
+        BTREE_COUNT(btreeBorrows);
     }
 
     void fill(BTreeNode *node, unsigned idx) {
@@ -383,6 +1440,250 @@ BTREE_TPL class BTree {
         return cursor;
     }
 
+    // the part of a node a lookup reads, values are fetched once the key is found
+    static void prefetchKeys(BTreeNodePtr node) {
+        auto begin = reinterpret_cast<uintptr_t>(&*node.ptr) & ~uintptr_t(63);
+        auto end = reinterpret_cast<uintptr_t>(node->keys + ORDER - 1);
+        for (auto p = begin; p < end; p += 64) {
+            __builtin_prefetch(reinterpret_cast<const void *>(p));
+        }
+    }
+
+    BTreeCursor doLowerBound(BTreeNodePtr node, const K &key) const {
+        BTreeCursor cursor;
+        while (true) {
+            auto idx = node->locate(key);
+            if (idx < node->len) {
+                // anything found further down is smaller than this one
+                cursor = {node, idx};
+            }
+            if (node.isLeaf()) {
+                return cursor;
+            }
+            node = node.children()[idx];
+        }
+    }
+
+    template <typename Fn>
+    void doForEach(BTreeNodePtr node, Fn &fn) const {
+        if (node.isLeaf()) {
+            for (unsigned i = 0; i < node->len; i++) {
+                fn(static_cast<const K &>(node->keys[i]), static_cast<const V &>(node->vals[i]));
+            }
+            return;
+        }
+        for (unsigned i = 0; i < node->len; i++) {
+            doForEach(node.children()[i], fn);
+            fn(static_cast<const K &>(node->keys[i]), static_cast<const V &>(node->vals[i]));
+        }
+        doForEach(node.children()[node->len], fn);
+    }
+
+    // returned by internal scan callbacks that may end the scan early
+    enum class ScanStep { Next, Stop };
+
+    // Entries in [lo, hi) in order, a null bound is open; returns false once hi is reached or
+    // fn returned ScanStep::Stop.
+    template <typename Fn>
+    bool doRangeScan(BTreeNodePtr node, const K *lo, const K *hi, Fn &fn) const {
+        unsigned i = lo ? node->locate(*lo) : 0;
+        for (; i <= node->len; i++) {
+            if (!node.isLeaf() && !doRangeScan(node.children()[i], lo, hi, fn)) {
+                return false;
+            }
+            // everything right of the first child visited is >= lo
+            lo = nullptr;
+            if (i == node->len) {
+                break;
+            }
+            if (hi && !Cmp()(node->keys[i], *hi)) {
+                return false;
+            }
+            const K &key = node->keys[i];
+            const V &val = node->vals[i];
+            if constexpr (std::is_same_v<decltype(fn(key, val)), ScanStep>) {
+                if (fn(key, val) == ScanStep::Stop) {
+                    return false;
+                }
+            } else {
+                fn(key, val);
+            }
+        }
+        return true;
+    }
+
+    // Split n sorted entries into nodes of at most ORDER - 1 entries, with one separator entry
+    // between neighbouring nodes that goes one level up. Node g takes [first(g), first(g) + len(g)),
+    // its separator is entry first(g) + len(g). Every node but a lone root is at least half full.
+    struct BulkLayout {
+        size_t nodes, base, rem;
+        BulkLayout(size_t n): nodes((n + ORDER) / ORDER) {
+            auto stored = n - (nodes - 1);
+            base = stored / nodes;
+            rem = stored % nodes;
+        }
+        size_t first(size_t g) const { return g * (base + 1) + std::min(g, rem); }
+        unsigned len(size_t g) const { return base + (g < rem); }
+    };
+
+    // Build the tree bottom up from sorted [first, first + n), one level at a time.
+    // exec(cnt, fn) has to call fn(i) for every i in [0, cnt), nodes of a level are independent.
+    template <typename It, typename Exec>
+    void doBulkLoad(It first, size_t n, Exec exec) {
+        releaseAllVals();
+        dropRoot();
+        if (n == 0) {
+            // the empty tree dropRoot() left behind, like a fresh one
+            return;
+        }
+        Slot *vals = nullptr;
+        if constexpr (kSeparateVals) {
+            vals = slab.allocRange(n);
+        }
+
+        BulkLayout layout(n);
+        std::vector<BTreeNodePtr> level(layout.nodes);
+        // a lone leaf is the root and goes inline, as with insert()
+        auto lone = layout.nodes == 1 ? inlineRoot() : nullptr;
+        exec(layout.nodes, [&](size_t g) {
+            auto leaf = lone ? lone : newNode<BTreeLeaf>();
+            auto off = layout.first(g);
+            leaf->len = layout.len(g);
+            for (unsigned i = 0; i < leaf->len; i++) {
+                leaf->keys[i] = first[off + i].first;
+                storeVal(leaf->vals[i], first[off + i].second, vals ? vals + off + i : nullptr);
+            }
+            level[g] = leaf;
+        });
+        // input positions of the separators between nodes of `level`
+        std::vector<size_t> seps(layout.nodes - 1);
+        for (size_t g = 0; g < seps.size(); g++) {
+            seps[g] = layout.first(g) + layout.len(g);
+        }
+
+        while (level.size() > 1) {
+            BulkLayout up(seps.size());
+            std::vector<BTreeNodePtr> parents(up.nodes);
+            exec(up.nodes, [&](size_t g) {
+                auto node = newNode<BTreeNode>();
+                auto off = up.first(g);
+                node->len = up.len(g);
+                for (unsigned i = 0; i < node->len; i++) {
+                    node->keys[i] = first[seps[off + i]].first;
+                    storeVal(node->vals[i], first[seps[off + i]].second, vals ? vals + seps[off + i] : nullptr);
+                }
+                for (unsigned i = 0; i <= node->len; i++) {
+                    node->children[i] = level[off + i];
+                    level[off + i]->parent = node;
+                }
+                parents[g] = node;
+            });
+            std::vector<size_t> upSeps(up.nodes - 1);
+            for (size_t g = 0; g < upSeps.size(); g++) {
+                upSeps[g] = seps[up.first(g) + up.len(g)];
+            }
+            level.swap(parents);
+            seps.swap(upSeps);
+        }
+        root = level[0];
+        resetEnds();
+    }
+
+    // Cut the top of the tree into at least `want` disjoint subtrees (if the tree is deep enough).
+    // parts and seps come out in key order, interleaved: parts[0], seps[0], parts[1], ...
+    void collectParts(BTreeNodePtr node, unsigned depth, std::vector<BTreeNodePtr> &parts,
+                      std::vector<BTreeCursor> &seps) const {
+        if (depth == 0 || node.isLeaf()) {
+            parts.push_back(node);
+            return;
+        }
+        for (unsigned i = 0; i < node->len; i++) {
+            collectParts(node.children()[i], depth - 1, parts, seps);
+            seps.push_back({node, i});
+        }
+        collectParts(node.children()[node->len], depth - 1, parts, seps);
+    }
+
+    // fn(i) for every i in [0, n), spread over the pool in contiguous chunks.
+    // Waits for its own tasks only, but must not be called from a task of the same pool.
+    // The first exception thrown by fn is rethrown here once every chunk has stopped, items
+    // not reached by then are skipped.
+    template <typename Fn>
+    static void runParallel(ThreadPool &pool, size_t n, Fn fn) {
+        auto chunks = std::min(n, pool.getThreadNum() * 4);
+        if (chunks <= 1) {
+            for (size_t i = 0; i < n; i++) {
+                fn(i);
+            }
+            return;
+        }
+        std::mutex mtx;
+        std::condition_variable cond;
+        size_t left = chunks;
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+        for (size_t c = 0; c < chunks; c++) {
+            pool.enqueue([&, c]() {
+                try {
+                    for (size_t i = n * c / chunks; i < n * (c + 1) / chunks; i++) {
+                        if (failed.load(std::memory_order_relaxed)) {
+                            break;
+                        }
+                        fn(i);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lk(mtx);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    failed.store(true, std::memory_order_relaxed);
+                }
+                std::lock_guard<std::mutex> lk(mtx);
+                if (--left == 0) {
+                    cond.notify_one();
+                }
+            });
+        }
+        std::unique_lock<std::mutex> lk(mtx);
+        cond.wait(lk, [&]() { return left == 0; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    template <typename Fn>
+    void doParallelScan(ThreadPool &pool, const K *lo, const K *hi, Fn &fn) const {
+        if (!root) {
+            return;
+        }
+        std::vector<BTreeNodePtr> parts;
+        std::vector<BTreeCursor> seps;
+        for (unsigned depth = 1; ; depth++) {
+            parts.clear();
+            seps.clear();
+            collectParts(root, depth, parts, seps);
+            if (parts.size() >= pool.getThreadNum() * 4 || parts[0].isLeaf()) {
+                break;
+            }
+        }
+        runParallel(pool, parts.size(), [&](size_t i) {
+            // part i only holds keys between seps[i - 1] and seps[i]
+            if (i > 0 && hi && !Cmp()(seps[i - 1].key(), *hi)) {
+                return;
+            }
+            if (i < seps.size() && lo && Cmp()(seps[i].key(), *lo)) {
+                return;
+            }
+            doRangeScan(parts[i], lo, hi, fn);
+            if (i < seps.size()) {
+                auto sep = seps[i];
+                if ((!lo || !Cmp()(sep.key(), *lo)) && (!hi || Cmp()(sep.key(), *hi))) {
+                    fn(sep.key(), sep.val());
+                }
+            }
+        });
+    }
+
     bool doRemove(BTreeNodePtr node, const K &key) {
         auto idx = node->locate(key);
         if (idx < node->len && !Cmp()(key, node->keys[idx])) {
@@ -444,18 +1745,269 @@ BTREE_TPL class BTree {
         }
     }
 
+    // Filter sizing: built for kFilterHeadroom x the current size, rebuilt once the tree outgrows
+    // that or once a quarter of it went stale through removes.
+    static constexpr size_t kFilterHeadroom = 2;
+    static constexpr size_t kFilterMinKeys = 1024;
+
+    static constexpr bool kHashable = std::is_default_constructible_v<std::hash<K>>;
+
+    static uint64_t filterHash(const K &key) {
+        // insert() and find() refer to this even for keys that never get a filter
+        if constexpr (!kHashable) {
+            return 0;
+        } else {
+            // std::hash of integers is the identity, mix it (murmur3 finalizer)
+            uint64_t h = std::hash<K>{}(key);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ULL;
+            h ^= h >> 33;
+            return h;
+        }
+    }
+
+    // the root leaf is about to get a parent, move it out of the tree object first
+    void spillRoot() {
+        if (auto leaf = inlineRoot(); leaf && root.ptr.get() == leaf) {
+            auto heap = newNode<BTreeLeaf>();
+            heap->len = leaf->len;
+            std::move(leaf->keys, leaf->keys + leaf->len, heap->keys);
+            std::move(leaf->vals, leaf->vals + leaf->len, heap->vals);
+            leaf->len = 0;
+            root = heap;
+            resetEnds();
+        }
+    }
+
+    // free all nodes, values have to be released by the caller
+    void dropRoot() {
+        if (auto leaf = inlineRoot()) {
+            leaf->len = 0;
+        }
+        if (root.ptr.get() != inlineRoot()) {
+            // the whole tree goes away (destruction, bulk load, move assignment), which no
+            // reader may overlap, so nothing is retired
+            root.destructTree();
+        }
+        root = inlineRoot();
+        resetEnds();
+    }
+
+    void resetEnds() {
+        leftmost = rightmost = root;
+        if (!root) {
+            return;
+        }
+        while (!leftmost.isLeaf()) {
+            leftmost = leftmost.children()[0];
+        }
+        while (!rightmost.isLeaf()) {
+            rightmost = rightmost.children()[rightmost->len];
+        }
+    }
+
+    // frees a subtree cut off by erase_prefix() along with its values, returns its entry count
+    size_t dropSubtree(BTreeNodePtr node) {
+        size_t n = node->len;
+        for (unsigned i = 0; i < node->len; i++) {
+            releaseVal(node->vals[i]);
+        }
+        if (!node.isLeaf()) {
+            for (unsigned i = 0; i <= node->len; i++) {
+                n += dropSubtree(node.children()[i]);
+                node.children()[i] = nullptr;
+            }
+        }
+        node->len = 0;
+        node.destruct();
+        return n;
+    }
+
+    // bookkeeping for an entry gone by any path
+    void onRemoved() {
+        count--;
+        // removed keys stay in the filter as false positives until the next rebuild
+        if (filter && ++filterStale * 4 > filterKeys) {
+            rebuildFilter();
+        }
+    }
+
+    // entries of src into the empty dst, separated values go to consecutive slots at vals
+    void copyEntries(const BTreeLeaf &src, BTreeLeaf &dst, Slot *&vals) {
+        using Stored = typename KeyTraits::Stored;
+        dst.len = src.len;
+        if constexpr (std::is_trivially_copyable_v<Stored>) {
+            std::memcpy(dst.keys, src.keys, sizeof(src.keys));
+        } else {
+            std::copy_n(src.keys, src.len, dst.keys);
+        }
+        if constexpr (kSeparateVals) {
+            for (unsigned i = 0; i < src.len; i++) {
+                storeVal(dst.vals[i], src.vals[i], vals++);
+            }
+        } else if constexpr (std::is_trivially_copyable_v<V>) {
+            std::memcpy(dst.vals, src.vals, sizeof(src.vals));
+        } else {
+            std::copy_n(src.vals, src.len, dst.vals);
+        }
+    }
+
+    // steal the content of other, this has to be empty
+    void take(BTree &other) {
+        auto leaf = other.inlineRoot();
+        if (leaf && other.root.ptr.get() == leaf) {
+            auto mine = inlineRoot();
+            mine->len = leaf->len;
+            std::move(leaf->keys, leaf->keys + leaf->len, mine->keys);
+            std::move(leaf->vals, leaf->vals + leaf->len, mine->vals);
+            leaf->len = 0;
+            root = mine;
+        } else {
+            root = other.root;
+        }
+        other.root = leaf;
+        resetEnds();
+        other.resetEnds();
+        count = std::exchange(other.count, 0);
+        splits = std::exchange(other.splits, 0);
+        merges = std::exchange(other.merges, 0);
+        borrows = std::exchange(other.borrows, 0);
+        if constexpr (kSeparateVals) {
+            slab = std::move(other.slab);
+            other.slab.reset();
+        }
+        filter = std::move(other.filter);
+        filterBitsPerKey = other.filterBitsPerKey;
+        filterKeys = other.filterKeys;
+        filterStale = other.filterStale;
+    }
+
+    void rebuildFilter() {
+        filterKeys = std::max(count * kFilterHeadroom, kFilterMinKeys);
+        filterStale = 0;
+        filter = std::make_unique<BlockedBloomFilter>(filterKeys, filterBitsPerKey);
+        for_each([this](const K &k, const V &) { filter->add(filterHash(k)); });
+    }
+
     BTreeNodePtr root;
+    // leaves at both ends of the key space, kept up to date for front() and back()
+    BTreeNodePtr leftmost;
+    BTreeNodePtr rightmost;
+    size_t count{0};
+    uint64_t splits{0};
+    uint64_t merges{0};
+    uint64_t borrows{0};
+#ifdef BTREE_COMPACT_NODES
+    // compact links only name arena nodes, the root leaf is allocated with the first entry
+    BTreeLeaf *inlineRoot() { return nullptr; }
+#else
+    // Root leaf of a small tree, kept in the tree object so that tiny trees allocate nothing.
+    // It moves to the heap when it splits.
+    BTreeLeaf inlineLeaf;
+    BTreeLeaf *inlineRoot() { return &inlineLeaf; }
+#endif
+    std::conditional_t<kSeparateVals, ValueSlab<V>, NoSlab> slab;
+
+    std::unique_ptr<BlockedBloomFilter> filter;
+    unsigned filterBitsPerKey{0};
+    size_t filterKeys{0};
+    size_t filterStale{0};
 
 public:
-    BTree() : root(new BTreeLeaf()) {}
+    BTree() : root(inlineRoot()), leftmost(root), rightmost(root) {}
+
+    BTree(const BTree &other) : BTree(other.clone()) {}
+
+    BTree(BTree &&other) noexcept(kNothrowMove) : root(inlineRoot()) {
+        take(other);
+    }
+
+    BTree &operator=(const BTree &other) {
+        if (this != &other) {
+            *this = other.clone();
+        }
+        return *this;
+    }
+
+    BTree &operator=(BTree &&other) noexcept(kNothrowMove) {
+        if (this != &other) {
+            releaseAllVals();
+            dropRoot();
+            take(other);
+        }
+        return *this;
+    }
 
     ~BTree() {
-        root.destruct();
+        releaseAllVals();
+        dropRoot();
+    }
+
+    // Deep copy made one level at a time: every node is copied as is, with keys and values
+    // memcpy'd where their types allow it, nothing is compared or rebalanced.
+    BTree clone() const {
+        BTree copy;
+        copy.count = count;
+        if (filter) {
+            copy.filter = std::make_unique<BlockedBloomFilter>(*filter);
+            copy.filterBitsPerKey = filterBitsPerKey;
+            copy.filterKeys = filterKeys;
+            copy.filterStale = filterStale;
+        }
+        if (!root) {
+            return copy;
+        }
+        Slot *vals = nullptr;
+        if constexpr (kSeparateVals) {
+            vals = count ? copy.slab.allocRange(count) : nullptr;
+        }
+        if (root.isLeaf()) {
+            auto leaf = copy.inlineRoot() ? copy.inlineRoot() : newNode<BTreeLeaf>();
+            copy.copyEntries(*root.ptr, *leaf, vals);
+            copy.root = leaf;
+            copy.resetEnds();
+            return copy;
+        }
+
+        auto top = newNode<BTreeNode>();
+        copy.root = top;
+        // internal nodes of the current level, source and copy
+        std::vector<std::pair<BTreeNodePtr, BTreeNode *>> level{{root, top}}, next;
+        while (!level.empty()) {
+            next.clear();
+            for (auto [src, dst] : level) {
+                copy.copyEntries(*src.ptr, *dst, vals);
+                for (unsigned i = 0; i <= src->len; i++) {
+                    auto child = src.children()[i];
+                    if (child.isLeaf()) {
+                        auto leaf = newNode<BTreeLeaf>();
+                        copy.copyEntries(*child.ptr, *leaf, vals);
+                        leaf->parent = dst;
+                        dst->children[i] = leaf;
+                    } else {
+                        auto node = newNode<BTreeNode>();
+                        node->parent = dst;
+                        dst->children[i] = node;
+                        next.push_back({child, node});
+                    }
+                }
+            }
+            level.swap(next);
+        }
+        copy.resetEnds();
+        return copy;
     }
 
     void insert(const K &key, const V &val = {}) {
+        if (!root) {
+            root = newNode<BTreeLeaf>();
+            resetEnds();
+        }
         if (root->len == ORDER - 1) {
-            auto newRoot = new BTreeNode;
+            spillRoot();
+            auto newRoot = newNode<BTreeNode>();
             newRoot->children[0] = root;
             root->parent = newRoot;
             splitChild(newRoot, 0);
@@ -464,30 +2016,344 @@ public:
         } else {
             insertNonFull(root, key, val);
         }
+        count++;
+        if (filter) {
+            if (count > filterKeys) {
+                rebuildFilter();
+            } else {
+                filter->add(filterHash(key));
+            }
+        }
     }
 
     BTreeCursor find(const K &key) const {
+        if (!root || (filter && !filter->mayContain(filterHash(key)))) {
+            return {};
+        }
         return doFind(root, key);
     }
 
+#ifdef BTREE_COROUTINES
+    // find() as a coroutine that prefetches each child and yields before descending into it, run
+    // many at once with coro::interleave() to overlap their misses. The tree must outlive it and
+    // stay unmodified until it is done.
+    coro::Task<BTreeCursor> find_async(K key) const {
+        if (!root || (filter && !filter->mayContain(filterHash(key)))) {
+            co_return BTreeCursor{};
+        }
+        auto node = root;
+        while (true) {
+            auto idx = node->locate(key);
+            if (idx < node->len && !Cmp()(key, node->keys[idx])) {
+                co_return BTreeCursor{node, idx};
+            }
+            if (node.isLeaf()) {
+                co_return BTreeCursor{};
+            }
+            node = node.children()[idx];
+            prefetchKeys(node);
+            co_await coro::yield();
+        }
+    }
+#endif
+
+    // Keep a blocked Bloom filter of all keys so that most misses of find() cost one cache miss
+    // instead of a descent. About 10 bits per key give 1% false positives. Needs std::hash<K>
+    // and keys that are equivalent under Cmp to hash equal.
+    void enable_filter(unsigned bitsPerKey = 10) {
+        static_assert(kHashable, "enable_filter needs std::hash<K>");
+        filterBitsPerKey = bitsPerKey;
+        rebuildFilter();
+    }
+
+    void disable_filter() {
+        filter.reset();
+    }
+
+    // first entry whose key is not less than key
+    BTreeCursor lower_bound(const K &key) const {
+        if (!root) {
+            return {};
+        }
+        return doLowerBound(root, key);
+    }
+
+    // in-order walk, fn(const K &, const V &)
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        if (root) {
+            doForEach(root, fn);
+        }
+    }
+
+    // entries with lo <= key < hi in order, fn(const K &, const V &)
+    template <typename Fn>
+    void range_scan(const K &lo, const K &hi, Fn fn) const {
+        if (root) {
+            doRangeScan(root, &lo, &hi, fn);
+        }
+    }
+
+    // entries with lo <= key in order while fn(const K &, const V &) returns true
+    template <typename Fn>
+    void scan_from(const K &lo, Fn fn) const {
+        auto step = [&fn](const K &key, const V &val) { return fn(key, val) ? ScanStep::Next : ScanStep::Stop; };
+        if (root) {
+            doRangeScan(root, &lo, nullptr, step);
+        }
+    }
+
+    // replace the content with sorted [first, last) of (key, value) pairs, built bottom up
+    template <typename It>
+    void bulk_load(It first, It last) {
+        doBulkLoad(first, last - first, [](size_t n, auto fn) {
+            for (size_t i = 0; i < n; i++) {
+                fn(i);
+            }
+        });
+        count = last - first;
+        if (filter) {
+            rebuildFilter();
+        }
+    }
+
+    // bulk_load with every level built across the pool
+    template <typename It>
+    void parallel_bulk_load(ThreadPool &pool, It first, It last) {
+        doBulkLoad(first, last - first, [&pool](size_t n, auto fn) {
+            runParallel(pool, n, fn);
+        });
+        count = last - first;
+        if (filter) {
+            rebuildFilter();
+        }
+    }
+
+    // for_each with the key space cut at the top levels of the tree and the pieces scanned on
+    // the pool. fn is called concurrently and in no particular order across pieces.
+    template <typename Fn>
+    void parallel_for_each(ThreadPool &pool, Fn fn) const {
+        doParallelScan(pool, nullptr, nullptr, fn);
+    }
+
+    // range_scan split like parallel_for_each, pieces outside of [lo, hi) are skipped
+    template <typename Fn>
+    void parallel_range_scan(ThreadPool &pool, const K &lo, const K &hi, Fn fn) const {
+        doParallelScan(pool, &lo, &hi, fn);
+    }
+
+    // pointer-free read-only copy of the current content, see FrozenBTree
+    FrozenBTree<K, V, Cmp> freeze() const {
+        std::vector<K> keys;
+        std::vector<V> vals;
+        for_each([&](const K &k, const V &v) {
+            keys.push_back(k);
+            vals.push_back(v);
+        });
+        return FrozenBTree<K, V, Cmp>(keys, std::move(vals));
+    }
+
+    // freeze() with frame-of-reference compressed leaves, for integer keys in ascending order
+    CompressedFrozenBTree<K, V> freeze_compressed() const {
+        static_assert(std::is_same_v<Cmp, std::less<K>>, "compressed leaves store keys in ascending order");
+        std::vector<K> keys;
+        std::vector<V> vals;
+        for_each([&](const K &k, const V &v) {
+            keys.push_back(k);
+            vals.push_back(v);
+        });
+        return CompressedFrozenBTree<K, V>(keys, std::move(vals));
+    }
+
     bool remove(const K &key) {
+        if (!root) {
+            return false;
+        }
         auto ret = doRemove(root, key);
 
         if (!root.isLeaf() && root->len == 0) {
             auto tmp = root;
             root = root.children()[0];
-            root.parent = nullptr;
+            root->parent = nullptr;
             tmp.children()[0] = nullptr;
             tmp.destruct();
         }
 
+        if (ret) {
+            onRemoved();
+        }
         return ret;
     }
 
+    // smallest entry, invalid if the tree is empty
+    BTreeCursor front() const {
+        if (!leftmost || leftmost->len == 0) {
+            return {};
+        }
+        return {leftmost, 0};
+    }
+
+    // largest entry, invalid if the tree is empty
+    BTreeCursor back() const {
+        if (!rightmost || rightmost->len == 0) {
+            return {};
+        }
+        return {rightmost, rightmost->len - 1u};
+    }
+
+    // Remove the smallest entry, straight from the cached leaf as long as that leaves it at least
+    // half full or it can borrow from its sibling. Only a merge, which shrinks the parent, has to
+    // go through remove() and rebalance on the way down.
+    bool pop_front() {
+        if (!front().valid()) {
+            return false;
+        }
+        auto &leaf = leftmost.leaf();
+        if (leaf.len > ORDER / 2 || !leaf.parent || leaf.parent->children[1]->len >= ORDER / 2) {
+            removeFromLeaf(&leaf, 0);
+            onRemoved();
+            return true;
+        }
+        K key = leaf.keys[0];
+        return remove(key);
+    }
+
+    // pop_front() for the largest entry
+    bool pop_back() {
+        if (!back().valid()) {
+            return false;
+        }
+        auto &leaf = rightmost.leaf();
+        if (leaf.len > ORDER / 2 || !leaf.parent || leaf.parent->children[leaf.parent->len - 1]->len >= ORDER / 2) {
+            removeFromLeaf(&leaf, leaf.len - 1);
+            onRemoved();
+            return true;
+        }
+        K key = leaf.keys[leaf.len - 1];
+        return remove(key);
+    }
+
+    // Erase all entries with keys less than hi, returns how many. A range cut: walks down the
+    // left edge of what survives, dropping the subtrees left of it whole and refilling each node
+    // on the path from its right sibling, so the tree is touched in O(height) nodes besides the
+    // ones freed. Values are released one by one, the nodes holding them are not looked at again.
+    size_t erase_prefix(const K &hi) {
+        if (!root) {
+            return 0;
+        }
+        size_t erased = 0;
+        auto node = root;
+        while (true) {
+            unsigned idx = node->locate(hi);
+            for (unsigned i = 0; i < idx; i++) {
+                releaseVal(node->vals[i]);
+                if (!node.isLeaf()) {
+                    erased += dropSubtree(node.children()[i]);
+                }
+            }
+            if (idx > 0) {
+                std::move(node->keys + idx, node->keys + node->len, node->keys);
+                std::move(node->vals + idx, node->vals + node->len, node->vals);
+                if (!node.isLeaf()) {
+                    std::move(node.children() + idx, node.children() + node->len + 1, node.children());
+                }
+                node->len -= idx;
+                erased += idx;
+            }
+
+            if (BTreeNode *parent = node->parent) {
+                // the parent already kept its first key, so it can always lend or merge into node
+                while (node->len < ORDER / 2 && parent->len > 0) {
+                    fill(parent, 0);
+                }
+                if (parent->len == 0) {
+                    // only the root gets to run out of keys, node takes its place
+                    assert(!parent->parent);
+                    auto tmp = root;
+                    root = node;
+                    root->parent = nullptr;
+                    tmp.children()[0] = nullptr;
+                    tmp.destruct();
+                }
+            } else if (!node.isLeaf() && node->len == 0) {
+                // the cut emptied the root, its only child is cut next as the new root
+                auto tmp = root;
+                root = node = root.children()[0];
+                root->parent = nullptr;
+                tmp.children()[0] = nullptr;
+                tmp.destruct();
+                continue;
+            }
+            if (node.isLeaf()) {
+                break;
+            }
+            node = node.children()[0];
+        }
+        count -= erased;
+        if (filter && (filterStale += erased) * 4 > filterKeys) {
+            rebuildFilter();
+        }
+        resetEnds();
+        return erased;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // Walks every node once. Out-of-line values count with their own size on both sides.
+    BTreeStats stats() const {
+        BTreeStats st;
+        st.entries = count;
+        st.splits = splits;
+        st.merges = merges;
+        st.borrows = borrows;
+        if (!root) {
+            return st;
+        }
+        constexpr size_t kEntryBytes = sizeof(typename KeyTraits::Stored) + sizeof(StoredVal);
+        size_t nodes = 0;
+        size_t stored = 0;
+        st.minFill = 1;
+        std::vector<BTreeNodePtr> level{root}, next;
+        while (!level.empty()) {
+            st.levelNodes.push_back(level.size());
+            next.clear();
+            for (auto node : level) {
+                nodes++;
+                stored += node->len;
+                st.bytesUsed += node->len * kEntryBytes;
+                if (!(node == root)) {
+                    st.minFill = std::min(st.minFill, double(node->len) / (ORDER - 1));
+                }
+                if (node.isLeaf()) {
+                    st.bytesAllocated += sizeof(BTreeLeaf);
+                    continue;
+                }
+                st.bytesAllocated += sizeof(BTreeNode);
+                st.bytesUsed += (node->len + 1) * sizeof(BTreeNodePtr);
+                next.insert(next.end(), node.children(), node.children() + node->len + 1);
+            }
+            level.swap(next);
+        }
+        st.height = st.levelNodes.size();
+        st.avgFill = double(stored) / (nodes * (ORDER - 1));
+        if (nodes == 1) {
+            st.minFill = st.avgFill;
+        }
+        if constexpr (kSeparateVals) {
+            st.bytesUsed += count * sizeof(V);
+            st.bytesAllocated += count * sizeof(V);
+        }
+        return st;
+    }
+
     void traverse(bool print = false) {
         int last = -1;
         int counter = 0;
-        doTraverse(root, 0, last, counter, print);
+        if (root) {
+            doTraverse(root, 0, last, counter, print);
+        }
         if (print) {
             std::cout << counter << " nodes traversed" << std::endl;
         }
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <limits>
@@ -11,9 +12,15 @@
 #include <optional>
 #include <cassert>
 #include <stdexcept>
+#include <type_traits>
 
 #define BTREE_TPL 
 
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define BTREE_COROUTINES
+#include "coro.h"
+#endif
+
 #ifdef BTREE_DEBUG
 static auto &dbg = std::cout;
 #else
@@ -26,17 +33,78 @@ struct NullStream {
 static NullStream dbg;
 #endif
 
-template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
+/**
+ * Aggregates kept per subtree on top of the entry count, one policy per tree:
+ *   using Value = ...;
+ *   static Value identity();
+ *   static Value of(const K &key, const V &val);                 // a single entry
+ *   static Value combine(const Value &left, const Value &right); // associative
+ * combine() is always applied in key order, so it needs not be commutative.
+ */
+struct BTreeNoAggregate {
+    struct Value {};
+    static Value identity() { return {}; }
+    template <typename K, typename V>
+    static Value of(const K &, const V &) { return {}; }
+    static Value combine(const Value &, const Value &) { return {}; }
+};
+
+template <typename T>
+struct BTreeSum {
+    using Value = T;
+    static T identity() { return T{}; }
+    template <typename K, typename V>
+    static T of(const K &, const V &val) { return T(val); }
+    static T combine(const T &a, const T &b) { return a + b; }
+};
+
+template <typename T>
+struct BTreeMin {
+    using Value = T;
+    static T identity() { return std::numeric_limits<T>::max(); }
+    template <typename K, typename V>
+    static T of(const K &, const V &val) { return T(val); }
+    static T combine(const T &a, const T &b) { return std::min(a, b); }
+};
+
+template <typename T>
+struct BTreeMax {
+    using Value = T;
+    static T identity() { return std::numeric_limits<T>::lowest(); }
+    template <typename K, typename V>
+    static T of(const K &, const V &val) { return T(val); }
+    static T combine(const T &a, const T &b) { return std::max(a, b); }
+};
+
+/**
+ * Count is the type of subtree sizes and thus of ranks, it has to hold the number of entries
+ * plus one: uint32_t up to 4 billion entries, uint64_t beyond, a narrower one for small trees.
+ * Agg is an aggregate policy as above, nodes carry nothing extra with the default.
+ */
+template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{}), typename Count = uint32_t,
+          typename Agg = BTreeNoAggregate>
 class IntrusiveBTree {
     static_assert(ORDER >= 3, "ORDER must be at least 3");
+    static_assert(std::is_unsigned_v<Count>, "Count must be an unsigned integer type");
 
     struct BTreeNode;
 
-    struct BTreeLeaf {
+    static constexpr bool kAggregate = !std::is_same_v<Agg, BTreeNoAggregate>;
+    using AggValue = typename Agg::Value;
+
+    struct WithAggregate {
+        AggValue agg = Agg::identity(); // of all entries of the subtree
+    };
+    struct WithoutAggregate {};
+
+    static constexpr unsigned kOffsetSlots = (ORDER - 1 + 3) / 4 * 4;
+    static constexpr Count kNoRank = std::numeric_limits<Count>::max();
+
+    struct BTreeLeaf: public std::conditional_t<kAggregate, WithAggregate, WithoutAggregate> {
         bool isLeaf;
         static_assert(std::numeric_limits<uint8_t>::max() >= ORDER - 1, "ORDER is too large for uint8_t");
         uint8_t len{0};
-        unsigned size{0}; // size of current and all its children
+        Count size{0}; // size of current and all its children
         BTreeNode *parent;
         K keys[ORDER - 1];
         V vals[ORDER - 1];
@@ -85,6 +153,11 @@ class IntrusiveBTree {
 
     struct BTreeNode: public BTreeLeaf {
         using BTreeLeaf::len;
+        // offsets[i]: entries in children[0..i] and keys[0..i], i.e. the rank of keys[i] + 1
+        // within this subtree. Spares rank and select a visit to every child left of the path.
+        // Slots from len on hold kNoRank; laid out ahead of children so that it shares their
+        // cache lines.
+        Count offsets[kOffsetSlots];
         BTreeNodePtr children[ORDER];
         ~BTreeNode() {
             if (len == 0) {
@@ -94,7 +167,31 @@ class IntrusiveBTree {
                 children[i].destruct();
             }
         }
-        BTreeNode(BTreeNode *parent = nullptr): BTreeLeaf(false, parent) {}
+        BTreeNode(BTreeNode *parent = nullptr): BTreeLeaf(false, parent) {
+            std::fill(offsets, offsets + kOffsetSlots, kNoRank);
+        }
+
+        // entries in front of children[i]
+        Count before(unsigned i) const {
+            return i ? offsets[i - 1] : 0;
+        }
+
+        // number of keys with offsets[j] <= k, i.e. the child or key holding rank k. A fixed
+        // count over the padded array, which compiles to a few vector compares.
+        unsigned rankIndex(Count k) const {
+            unsigned cnt = 0;
+            for (unsigned j = 0; j < kOffsetSlots; j++) {
+                cnt += offsets[j] <= k;
+            }
+            return cnt;
+        }
+
+        // an entry was added to (delta = 1) or removed from (delta = -1) the subtree of child i
+        void adjust(unsigned i, int delta) {
+            for (unsigned j = i; j < len; j++) {
+                offsets[j] += delta;
+            }
+        }
     };
 
     struct BTreeCursor {
@@ -103,6 +200,39 @@ class IntrusiveBTree {
         bool valid() const { return node; }
         const K &key() { assert(node); return node->keys[idx]; }
         V &val() { assert(node); return node->vals[idx]; }
+
+        // step to the next entry in key order, invalid past the last one
+        void next() {
+            assert(node);
+            if (!node.isLeaf()) {
+                auto cur = node.children()[idx + 1];
+                while (!cur.isLeaf()) {
+                    cur = cur.children()[0];
+                }
+                node = cur;
+                idx = 0;
+                return;
+            }
+            if (idx + 1 < node->len) {
+                idx++;
+                return;
+            }
+            // climb until coming up from a child that has a key to its right
+            BTreeLeaf *child = node.ptr;
+            for (BTreeNode *parent = node->parent; parent; parent = parent->parent) {
+                unsigned i = 0;
+                while (parent->children[i].ptr != child) {
+                    i++;
+                }
+                if (i < parent->len) {
+                    node = parent;
+                    idx = i;
+                    return;
+                }
+                child = parent;
+            }
+            node = nullptr;
+        }
     };
 
     BTreeCursor getPredecessor(BTreeNode *node, unsigned idx) const {
@@ -153,6 +283,32 @@ class IntrusiveBTree {
         }
     }
 
+    // recompute the aggregate of node from its entries and the aggregates of its children
+    static void refresh(BTreeNodePtr node) {
+        if constexpr (kAggregate) {
+            auto acc = Agg::identity();
+            for (unsigned i = 0; i < node->len; i++) {
+                if (!node.isLeaf()) {
+                    acc = Agg::combine(acc, node.children()[i]->agg);
+                }
+                acc = Agg::combine(acc, Agg::of(node->keys[i], node->vals[i]));
+            }
+            if (!node.isLeaf()) {
+                acc = Agg::combine(acc, node.children()[node->len]->agg);
+            }
+            node->agg = acc;
+        }
+    }
+
+    // an entry below node changed, bring the aggregates up to the root in line
+    static void refreshUp(BTreeLeaf *node) {
+        if constexpr (kAggregate) {
+            for (; node; node = node->parent) {
+                refresh(node);
+            }
+        }
+    }
+
     void merge(BTreeNodePtr node, int idx) {
         auto child = node.children()[idx];
         auto sibling = node.children()[idx + 1];
@@ -176,16 +332,25 @@ class IntrusiveBTree {
                 sibling.children()[i]->parent = &child.node();
                 child.children()[child->len + 1 + i] = sibling.children()[i];
             }
+            auto &offsets = child.node().offsets;
+            offsets[child->len] = child->size + 1;
+            for (int i = 0; i < sibling->len; i++) {
+                offsets[child->len + 1 + i] = child->size + 1 + sibling.node().offsets[i];
+            }
         }
         // Remove sibling from parent
         std::move(node->keys + idx + 1, node->keys + node->len, node->keys + idx);
         std::move(node->vals + idx + 1, node->vals + node->len, node->vals + idx);
         std::move(node.children() + idx + 2, node.children() + node->len + 1, node.children() + idx + 1);
+        // entries behind the removed key keep their ranks
+        std::move(node.node().offsets + idx + 1, node.node().offsets + node->len, node.node().offsets + idx);
         // Update lengths
         child->len += sibling->len + 1;
         child->size += sibling->size + 1;
         node->len--;
+        node.node().offsets[node->len] = kNoRank;
         // node->size stays put
+        refresh(child);
         sibling->len = 0;
         // sibling->size does not matter
         if (!sibling.isLeaf()) {
@@ -206,12 +371,21 @@ class IntrusiveBTree {
         std::move(node->vals + idx + 1, node->vals + node->len, node->vals + idx);
         node->len--;
         node->size--;
+        refresh(node);
 
         // size-=1 recursively up to the root
+        BTreeLeaf *c = node;
         BTreeNode *n = node->parent;
         while(n) {
             dbg << "decr size from " << std::hex << (uintptr_t(n) & 0xffff) << std::dec << "(" << int(node->len) << ")" << std::endl;
             n->size--;
+            unsigned i = 0;
+            while (n->children[i].ptr != c) {
+                i++;
+            }
+            n->adjust(i, -1);
+            refresh(n);
+            c = n;
             n = n->parent;
         }
 
@@ -226,27 +400,22 @@ class IntrusiveBTree {
     void removeFromNonLeaf(BTreeNode *node, unsigned idx) {
         dbg << "remove #" << idx << "(" << node->keys[idx] << ") from ";
         printNode(node);
+        // The predecessor (successor) is removed by descending to it like any other key, so that
+        // every node on the way is filled first. node keeps its keys on the way down, so its
+        // copy of the key can serve as the key to remove.
         if (node->children[idx]->len >= ORDER / 2) {
             auto pred = getPredecessor(node, idx);
             assert(pred.valid());
             node->keys[idx] = pred.key();
             node->vals[idx] = pred.val();
-            if (pred.node.isLeaf()) {
-                removeFromLeaf(&pred.node.leaf(), pred.idx);
-            } else {
-                removeFromNonLeaf(&pred.node.node(), pred.idx);
-            }
+            doRemove(node->children[idx], node->keys[idx]);
         } else if (node->children[idx + 1]->len >= ORDER / 2) {
             auto succ = getSuccessor(node, idx);
             assert(succ.valid());
             node->keys[idx] = succ.key();
             node->vals[idx] = succ.val();
             dbg << "succ key: " << succ.key() << std::endl;
-            if (succ.node.isLeaf()) {
-                removeFromLeaf(&succ.node.leaf(), succ.idx);
-            } else {
-                removeFromNonLeaf(&succ.node.node(), succ.idx);
-            }
+            doRemove(node->children[idx + 1], node->keys[idx]);
         } else {
             auto key = node->keys[idx];
             merge(node, idx);
@@ -263,6 +432,7 @@ class IntrusiveBTree {
             node->vals[idx] = val;
             node->len++;
             node->size++;
+            refresh(node);
         } else {
             auto idx = node->locate(key);
             if (node.children()[idx]->len == ORDER - 1) {
@@ -273,6 +443,8 @@ class IntrusiveBTree {
             }
             insertNonFull(node.children()[idx], key, val);
             node->size++;
+            node.node().adjust(idx, 1);
+            refresh(node);
         }
     } 
 
@@ -286,16 +458,22 @@ class IntrusiveBTree {
         // Move upper half of keys and values to newChild
         std::move(child->keys + ORDER / 2, child->keys + ORDER - 1, newChild->keys);
         std::move(child->vals + ORDER / 2, child->vals + ORDER - 1, newChild->vals);
-        unsigned agg = 0;
+        // entries staying in child, in front of the middle key
+        Count kept = ORDER / 2 - 1;
         if (!child->isLeaf) {
             for(int i = ORDER / 2; i < ORDER; i++) {
-                agg += child.children()[i]->size;
                 child.children()[i]->parent = &newChild.node();
                 newChild.children()[i - ORDER / 2] = child.children()[i];
             }
+            auto &offsets = child.node().offsets;
+            kept = offsets[ORDER / 2 - 1] - 1;
+            for (unsigned i = ORDER / 2; i < ORDER - 1; i++) {
+                newChild.node().offsets[i - ORDER / 2] = offsets[i] - offsets[ORDER / 2 - 1];
+            }
+            std::fill(offsets + ORDER / 2 - 1, offsets + ORDER - 1, kNoRank);
         }
         newChild->len = ORDER - 1 - ORDER / 2;
-        newChild->size = ORDER - 1 - ORDER / 2 + agg;
+        newChild->size = child->size - kept - 1;
 
         // Insert middle key and value into parent
         std::move_backward(parent->keys + idx, parent->keys + parent->len, parent->keys + parent->len + 1);
@@ -304,9 +482,14 @@ class IntrusiveBTree {
         parent->vals[idx] = child->vals[ORDER / 2 - 1];
         std::move_backward(parent->children + idx + 1, parent->children + parent->len + 1, parent->children + parent->len + 2);
         parent->children[idx + 1] = newChild;
+        // entries behind the middle key keep their ranks
+        std::move_backward(parent->offsets + idx, parent->offsets + parent->len, parent->offsets + parent->len + 1);
+        parent->offsets[idx] = parent->before(idx) + kept + 1;
         
         child->len = ORDER / 2 - 1;
-        child->size -= newChild->size + 1;
+        child->size = kept;
+        refresh(child);
+        refresh(newChild);
         parent->len++;
         // parent->size stays put
     }
@@ -324,19 +507,31 @@ class IntrusiveBTree {
         node->keys[idx - 1] = sibling->keys[sibling->len - 1];
         node->vals[idx - 1] = sibling->vals[sibling->len - 1];
         // Move children if not leaf
+        Count moved = 1;
         if (!child.isLeaf()) {
             assert(!sibling.isLeaf());
             std::move_backward(child.children(), child.children() + child->len + 1, child.children() + child->len + 2);
             child.children()[0] = sibling.children()[sibling->len];
             child.children()[0]->parent = &child.node();
-            child->size += child.children()[0]->size;
-            sibling->size -= child.children()[0]->size;
+            moved += sibling->size - sibling.node().offsets[sibling->len - 1];
+            auto &offsets = child.node().offsets;
+            std::move_backward(offsets, offsets + child->len, offsets + child->len + 1);
+            offsets[0] = 0;
+            for (int i = 0; i < child->len + 1; i++) {
+                offsets[i] += moved;
+            }
         }
+        node->offsets[idx - 1] -= moved;
         // Update lengths
         child->len++;
-        child->size++;
+        child->size += moved;
         sibling->len--;
-        sibling->size--;
+        sibling->size -= moved;
+        if (!sibling.isLeaf()) {
+            sibling.node().offsets[sibling->len] = kNoRank;
+        }
+        refresh(child);
+        refresh(sibling);
     }
 
     void borrowFromNext(BTreeNode *node, unsigned idx) {
@@ -352,19 +547,30 @@ class IntrusiveBTree {
         std::move(sibling->keys + 1, sibling->keys + sibling->len, sibling->keys);
         std::move(sibling->vals + 1, sibling->vals + sibling->len, sibling->vals);
         // Move children if not leaf
+        Count moved = 1;
         if (!child.isLeaf()) {
             assert(!sibling.isLeaf());
             child.children()[child->len + 1] = sibling.children()[0];
             child.children()[child->len + 1]->parent = &child.node();
             std::move(sibling.children() + 1, sibling.children() + sibling->len + 1, sibling.children());
-            child->size += child.children()[child->len + 1]->size;
-            sibling->size -= child.children()[child->len + 1]->size;
+            auto &offsets = sibling.node().offsets;
+            moved = offsets[0];
+            child.node().offsets[child->len] = child->size + 1;
+            for (int i = 0; i < sibling->len - 1; i++) {
+                offsets[i] = offsets[i + 1] - moved;
+            }
         }
+        node->offsets[idx] += moved;
         // Update lengths
         child->len++;
-        child->size++;
+        child->size += moved;
         sibling->len--;
-        sibling->size--;
+        sibling->size -= moved;
+        if (!sibling.isLeaf()) {
+            sibling.node().offsets[sibling->len] = kNoRank;
+        }
+        refresh(child);
+        refresh(sibling);
     }
 
     void fill(BTreeNode *node, unsigned idx) {
@@ -402,6 +608,15 @@ class IntrusiveBTree {
         }
     }
 
+    // the part of a node a lookup reads, values are fetched once the key is found
+    static void prefetchKeys(BTreeNodePtr node) {
+        auto begin = reinterpret_cast<uintptr_t>(node.ptr) & ~uintptr_t(63);
+        auto end = reinterpret_cast<uintptr_t>(node->keys + ORDER - 1);
+        for (auto p = begin; p < end; p += 64) {
+            __builtin_prefetch(reinterpret_cast<const void *>(p));
+        }
+    }
+
     BTreeCursor doFind(BTreeNodePtr node, const K &key) const {
         BTreeCursor cursor;
         auto idx = node->locate(key);
@@ -438,6 +653,86 @@ class IntrusiveBTree {
         }
     }
 
+    // the deepest node whose subtree holds both lo and hi, where their paths part
+    BTreeNodePtr forkOf(const K &lo, const K &hi) const {
+        BTreeNodePtr node = root;
+        while (!node.isLeaf()) {
+            auto i = node->locate(lo);
+            auto j = node->locate(hi);
+            bool found = (i < node->len && !Cmp()(lo, node->keys[i])) ||
+                         (j < node->len && !Cmp()(hi, node->keys[j]));
+            if (i != j || found) {
+                break;
+            }
+            node = node.children()[i];
+        }
+        return node;
+    }
+
+    // Combine items [from, to) of node in order, item 2i being children[i] and 2i + 1 entry i.
+    // Leaves just skip the even ones.
+    static AggValue combineItems(BTreeNodePtr node, unsigned from, unsigned to) {
+        auto acc = Agg::identity();
+        for (auto p = from; p < to; p++) {
+            if (p % 2) {
+                acc = Agg::combine(acc, Agg::of(node->keys[p / 2], node->vals[p / 2]));
+            } else if (!node.isLeaf()) {
+                acc = Agg::combine(acc, node.children()[p / 2]->agg);
+            }
+        }
+        return acc;
+    }
+
+    // aggregate over the entries not less than key (greater, unless withKey) in the subtree
+    static AggValue aggFrom(BTreeNodePtr node, const K &key, bool withKey) {
+        // everything right of the path so far, the deeper parts go in front of it
+        auto right = Agg::identity();
+        while (true) {
+            auto idx = node->locate(key);
+            bool found = idx < node->len && !Cmp()(key, node->keys[idx]);
+            if (found || node.isLeaf()) {
+                auto part = combineItems(node, 2 * idx + 1 + (found && !withKey), 2 * node->len + 1);
+                return Agg::combine(part, right);
+            }
+            right = Agg::combine(combineItems(node, 2 * idx + 1, 2 * node->len + 1), right);
+            node = node.children()[idx];
+        }
+    }
+
+    // aggregate over the entries less than key (not greater, if withKey) in the subtree
+    static AggValue aggBefore(BTreeNodePtr node, const K &key, bool withKey) {
+        auto left = Agg::identity();
+        while (true) {
+            auto idx = node->locate(key);
+            bool found = idx < node->len && !Cmp()(key, node->keys[idx]);
+            if (found || node.isLeaf()) {
+                return Agg::combine(left, combineItems(node, 0, 2 * idx + (found ? 1 + withKey : 0)));
+            }
+            left = Agg::combine(left, combineItems(node, 0, 2 * idx));
+            node = node.children()[idx];
+        }
+    }
+
+    // entries less than key (or not greater, if withKey) in the subtree of node
+    Count rankIn(BTreeNodePtr node, const K &key, bool withKey) const {
+        Count rank = 0;
+        while (true) {
+            printNode(node);
+            auto idx = node->locate(key);
+            bool found = idx < node->len && !Cmp()(key, node->keys[idx]);
+            if (node.isLeaf()) {
+                return rank + idx + (found && withKey);
+            }
+            auto &inner = node.node();
+            if (found) {
+                // found the exact one
+                return rank + inner.offsets[idx] - !withKey;
+            }
+            rank += inner.before(idx);
+            node = node.children()[idx];
+        }
+    }
+
     void doTraverse(BTreeNodePtr node, int depth, int &last, int &counter, bool print) {
         if (node->parent) {
             if (node->len < ORDER / 2 - 1) {
@@ -460,7 +755,7 @@ class IntrusiveBTree {
                 counter++;
             }
         } else {
-            unsigned agg = 0;
+            Count agg = 0;
             unsigned counterStart = counter;
             for (unsigned i = 0; i < node->len; i++) {
                 doTraverse(node.children()[i], depth + 1, last, counter, print);
@@ -473,9 +768,17 @@ class IntrusiveBTree {
                 last = node->keys[i];
                 counter++;
                 agg += node.children()[i]->size;
+                if (node.node().offsets[i] != agg + i + 1) {
+                    throw std::runtime_error("offset mismatch");
+                }
             }
             doTraverse(node.children()[node->len], depth + 1, last, counter, print);
             agg += node.children()[node->len]->size;
+            for (unsigned i = node->len; i < kOffsetSlots; i++) {
+                if (node.node().offsets[i] != kNoRank) {
+                    throw std::runtime_error("offset padding overwritten");
+                }
+            }
             if (agg + node->len != node->size) {
                 std::cout << std::endl;
                 printNode(&node.node());
@@ -500,6 +803,9 @@ public:
             newRoot->children[0] = root;
             root->parent = newRoot;
             newRoot->size = root->size;
+            if constexpr (kAggregate) {
+                newRoot->agg = root->agg;
+            }
             splitChild(newRoot, 0);
             insertNonFull(newRoot, key, val);
             root = newRoot;
@@ -512,6 +818,27 @@ public:
         return doFind(root, key);
     }
 
+#ifdef BTREE_COROUTINES
+    // find() as a coroutine that prefetches each child and yields before descending into it, run
+    // many at once with coro::interleave() to overlap their misses. The tree must outlive it and
+    // stay unmodified until it is done.
+    coro::Task<BTreeCursor> find_async(K key) const {
+        BTreeNodePtr node = root;
+        while (true) {
+            auto idx = node->locate(key);
+            if (idx < node->len && !Cmp()(key, node->keys[idx])) {
+                co_return BTreeCursor{node, uint8_t(idx)};
+            }
+            if (node.isLeaf()) {
+                co_return BTreeCursor{};
+            }
+            node = node.children()[idx];
+            prefetchKeys(node);
+            co_await coro::yield();
+        }
+    }
+#endif
+
     bool remove(const K &key) {
         auto ret = doRemove(root, key);
 
@@ -535,40 +862,92 @@ public:
         }
     }
 
-    unsigned getRank(const K &key) const {
-        unsigned rank = 0;
+    Count getRank(const K &key) const {
+        return rankIn(root, key, false);
+    }
+
+    // Number of entries between lo and hi, each bound counted in or not as given: [lo, hi) by
+    // default, 0 if the range is empty. Both bounds are looked up in a single descent until
+    // they part ways, then each of the two paths below that node once.
+    Count count_range(const K &lo, const K &hi, bool loInclusive = true, bool hiInclusive = false) const {
+        auto node = forkOf(lo, hi);
+        // ranks relative to the same subtree, what lies in front of it cancels out
+        auto end = rankIn(node, hi, hiInclusive);
+        auto begin = rankIn(node, lo, !loInclusive);
+        return end > begin ? end - begin : 0;
+    }
+
+    // The entry of rank k (0-based, the inverse of getRank), invalid if k >= size(). Walk on
+    // from there with next(), e.g. to read a page of entries by position.
+    BTreeCursor select(Count k) const {
+        if (k >= size()) {
+            return {};
+        }
         BTreeNodePtr node = root;
-        while (node) {
-            printNode(node);
-            auto idx = node->locate(key);
-            rank += idx;
-            if (!node.isLeaf()) {
-                for(int i = 0; i < idx; i++) {
-                    rank += node.children()[i]->size;
-                }
+        while (!node.isLeaf()) {
+            auto &inner = node.node();
+            auto i = inner.rankIndex(k);
+            if (i < node->len && k == inner.offsets[i] - 1) {
+                return {node, uint8_t(i)};
             }
-            if (idx < node->len && !Cmp()(key, node->keys[idx])) {
-                // found the exact one
-                if (!node.isLeaf()) {
-                    rank += node.children()[idx]->size;
-                }
-                break;
-            }
-            if (node.isLeaf()) {
-                break;
-            }
-            node = node.children()[idx];
+            k -= inner.before(i);
+            node = node.children()[i];
         }
-        return rank;
+        return {node, uint8_t(k)};
     }
 
-    unsigned size() const {
+    Count size() const {
         return root.ptr ? root->size : 0;
     }
+
+    // aggregate over all entries
+    AggValue aggregate() const {
+        static_assert(kAggregate, "the tree keeps no aggregate");
+        return root->agg;
+    }
+
+    // Aggregate over the entries between lo and hi, bounds as with count_range(). Combines the
+    // stored aggregates of whole subtrees along the paths to both bounds, O(ORDER log n).
+    AggValue aggregate_range(const K &lo, const K &hi, bool loInclusive = true, bool hiInclusive = false) const {
+        static_assert(kAggregate, "the tree keeps no aggregate");
+        if (Cmp()(hi, lo)) {
+            return Agg::identity();
+        }
+        auto node = forkOf(lo, hi);
+        auto i = node->locate(lo);
+        auto j = node->locate(hi);
+        bool foundLo = i < node->len && !Cmp()(lo, node->keys[i]);
+        bool foundHi = j < node->len && !Cmp()(hi, node->keys[j]);
+        // in items: the part of children[i] not below lo unless lo is a key here, everything
+        // in between, the part of children[j] below hi unless hi is a key here
+        auto acc = Agg::identity();
+        if (!foundLo && !node.isLeaf()) {
+            acc = aggFrom(node.children()[i], lo, loInclusive);
+        }
+        unsigned from = 2 * i + 1 + (foundLo && !loInclusive);
+        unsigned to = 2 * j + (foundHi ? 1 + hiInclusive : 0);
+        if (from < to) {
+            acc = Agg::combine(acc, combineItems(node, from, to));
+        }
+        if (!foundHi && !node.isLeaf()) {
+            acc = Agg::combine(acc, aggBefore(node.children()[j], hi, hiInclusive));
+        }
+        return acc;
+    }
+
+    // Set the value of an existing entry. Writing through cursor.val() bypasses the aggregates,
+    // this keeps them in line.
+    void update(BTreeCursor cursor, const V &val) {
+        assert(cursor.valid());
+        cursor.val() = val;
+        refreshUp(cursor.node.ptr);
+    }
 };
 
-template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
-using BTreeMap = IntrusiveBTree<K, V, ORDER, Cmp>;
+template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{}), typename Count = uint32_t,
+          typename Agg = BTreeNoAggregate>
+using BTreeMap = IntrusiveBTree<K, V, ORDER, Cmp, Count, Agg>;
 
-template <typename K, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>())>
-using BTreeSet = IntrusiveBTree<K, std::tuple<>, ORDER, Cmp>;
\ No newline at end of file
+template <typename K, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>()), typename Count = uint32_t,
+          typename Agg = BTreeNoAggregate>
+using BTreeSet = IntrusiveBTree<K, std::tuple<>, ORDER, Cmp, Count, Agg>;
\ No newline at end of file
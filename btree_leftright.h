@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "btree.h"
+
+/**
+ * Read-mostly BTreeMap for one writer and many readers, after the Left-Right technique: two
+ * instances of the map, readers use the one that is currently published while the writer
+ * applies an update to the other, publishes it, waits for readers to leave the old one and
+ * applies the same update there.
+ *
+ * Readers never lock, never wait and never retry; the only thing they write is a counter on a
+ * cache line of their own (one of kReaderSlots, picked per thread), so reads scale with cores.
+ * Writes cost two updates plus waiting for readers in flight, and the map is kept twice. Meant
+ * for tables that change a few times per second and are read all the time.
+ */
+template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
+class LeftRightBTreeMap {
+    using Map = BTreeMap<K, V, ORDER, Cmp>;
+
+    static constexpr unsigned kReaderSlots = 128;
+
+    // readers registered under either version
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> cnt[2] = {0, 0};
+    };
+
+    Map maps[2];
+    std::atomic<unsigned> published{0};    // the instance readers use
+    std::atomic<unsigned> version{0};      // the counter readers announce themselves on
+    std::mutex writeMtx;
+    mutable ReaderSlot slots[kReaderSlots];
+
+    static unsigned slotOfThread() {
+        static std::atomic<unsigned> next{0};
+        static thread_local unsigned slot = next.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+        return slot;
+    }
+
+    void waitForReaders(unsigned v) const {
+        for (auto &slot : slots) {
+            while (slot.cnt[v].load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Copy the published instance over the other one, which no reader may be on, after an
+    // update threw halfway through it.
+    void resync(unsigned lagging) {
+        maps[lagging] = maps[lagging ^ 1];
+    }
+
+public:
+    LeftRightBTreeMap() = default;
+    LeftRightBTreeMap(const LeftRightBTreeMap &) = delete;
+
+    // fn(const Map &) runs against the published instance, which does not change until it returns
+    template <typename Fn>
+    decltype(auto) read(Fn &&fn) const {
+        auto &cnt = slots[slotOfThread()].cnt[version.load(std::memory_order_seq_cst)];
+        cnt.fetch_add(1, std::memory_order_seq_cst);
+        struct Depart {
+            std::atomic<uint64_t> &cnt;
+            ~Depart() { cnt.fetch_sub(1, std::memory_order_release); }
+        } depart{cnt};
+        return fn(static_cast<const Map &>(maps[published.load(std::memory_order_seq_cst)]));
+    }
+
+    std::optional<V> find(const K &key) const {
+        return read([&key](const Map &map) -> std::optional<V> {
+            auto cur = map.find(key);
+            if (!cur.valid()) {
+                return {};
+            }
+            return cur.val();
+        });
+    }
+
+    bool contains(const K &key) const {
+        return read([&key](const Map &map) { return map.find(key).valid(); });
+    }
+
+    size_t size() const {
+        return read([](const Map &map) { return map.size(); });
+    }
+
+    // fn(Map &) is applied to both instances one after the other and has to do the same to both.
+    // If it throws on the first, the update is dropped; if it throws on the second, the update
+    // stays in effect. Either way the instance it threw on is rebuilt as a copy of the other one
+    // before the exception is rethrown, so that readers never see the two disagree.
+    template <typename Fn>
+    void update(Fn &&fn) {
+        std::lock_guard<std::mutex> lk(writeMtx);
+        auto cur = published.load(std::memory_order_relaxed);
+        try {
+            fn(maps[cur ^ 1]);
+        } catch (...) {
+            resync(cur ^ 1);
+            throw;
+        }
+        published.store(cur ^ 1, std::memory_order_seq_cst);
+
+        // A reader that arrived before the flip may be counted under either version. Wait out
+        // both in turn, toggling in between so that new arrivals, which all see the new instance,
+        // cannot keep the wait going forever.
+        auto v = version.load(std::memory_order_relaxed);
+        waitForReaders(v ^ 1);
+        version.store(v ^ 1, std::memory_order_seq_cst);
+        waitForReaders(v);
+        try {
+            fn(maps[cur]);
+        } catch (...) {
+            resync(cur);
+            throw;
+        }
+    }
+
+    void put(const K &key, const V &val) {
+        update([&](Map &map) {
+            auto cur = map.find(key);
+            if (cur.valid()) {
+                cur.val() = val;
+            } else {
+                map.insert(key, val);
+            }
+        });
+    }
+
+    bool remove(const K &key) {
+        bool removed = false;
+        update([&](Map &map) { removed = map.remove(key); });
+        return removed;
+    }
+};
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+#include "ebr.h"
+
+/**
+ * Multi-versioned BTreeMap. Every key maps to a chain of versions, newest first, each stamped
+ * with the commit timestamp of its write. A reader takes a Snapshot (a read timestamp) and sees
+ * for every key the newest version no younger than it, however long it keeps the snapshot.
+ *
+ * Writers are serialized among themselves and publish a version by swinging the head of its
+ * chain, so readers never wait for them. Adding a key or dropping a dead one locks the tree
+ * exclusively. Readers lock it shared only to look up a chain, or kBatch chains at a time in
+ * a scan, and follow the chains unlocked, so a writer waits for one such step at most and never
+ * for a whole snapshot scan. Chains dropped while a reader may still hold them are retired
+ * through ebr.h.
+ *
+ * Garbage collection is epoch based: the oldest read timestamp of all live snapshots is the
+ * horizon, everything behind the newest version visible at the horizon is unreachable for every
+ * present and future reader and is freed. Run it with collect() or on a background thread.
+ */
+template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
+class MvccBTreeMap {
+    struct Version {
+        uint64_t ts;
+        bool deleted;
+        V val;
+        Version *prev; // older version, cut only behind the horizon
+    };
+
+    struct Chain {
+        std::atomic<Version *> head{nullptr};
+    };
+
+    static constexpr unsigned kMaxSnapshots = 128;
+    static constexpr size_t kBatch = 64;
+    static constexpr uint64_t kFreeSlot = std::numeric_limits<uint64_t>::max();
+
+    struct alignas(64) SnapshotSlot {
+        std::atomic<uint64_t> ts{kFreeSlot};
+    };
+
+    BTree<K, Chain *, ORDER, Cmp> tree;
+    mutable std::shared_mutex treeMtx;
+    std::mutex writeMtx;
+    std::atomic<uint64_t> committed{0};
+    mutable SnapshotSlot slots[kMaxSnapshots];
+
+    std::mutex collectMtx;
+    std::thread gcThread;
+    std::mutex gcMtx;
+    std::condition_variable gcCond;
+    bool gcStop = false;
+
+    static const Version *visible(const Chain *chain, uint64_t ts) {
+        auto v = chain->head.load(std::memory_order_acquire);
+        while (v && v->ts > ts) {
+            v = v->prev;
+        }
+        return v;
+    }
+
+    static size_t freeChain(Version *v) {
+        size_t cnt = 0;
+        while (v) {
+            auto prev = v->prev;
+            delete v;
+            v = prev;
+            cnt++;
+        }
+        return cnt;
+    }
+
+    static void reclaimChain(void *p) {
+        auto chain = static_cast<Chain *>(p);
+        freeChain(chain->head.load(std::memory_order_relaxed));
+        delete chain;
+    }
+
+    // fn(const K &, Chain *) for every key in order, with the tree locked for one batch of
+    // entries at a time and fn running unlocked. Readers call it inside an ebr::Guard.
+    template <typename Fn>
+    void walk(Fn fn) const {
+        std::vector<std::pair<K, Chain *>> batch;
+        std::optional<K> after; // last key of the previous batch
+        do {
+            batch.clear();
+            {
+                std::shared_lock<std::shared_mutex> lk(treeMtx);
+                auto take = [&](const K &key, Chain *const &chain) {
+                    if (!after || Cmp()(*after, key)) {
+                        batch.emplace_back(key, chain);
+                    }
+                    return batch.size() < kBatch;
+                };
+                if (after) {
+                    tree.scan_from(*after, take);
+                } else if (auto first = tree.front(); first.valid()) {
+                    tree.scan_from(first.key(), take);
+                }
+            }
+            for (auto &[key, chain] : batch) {
+                fn(key, chain);
+            }
+            if (!batch.empty()) {
+                after = batch.back().first;
+            }
+        } while (batch.size() == kBatch);
+    }
+
+    uint64_t write(const K &key, const V *val) {
+        std::lock_guard<std::mutex> wlk(writeMtx);
+        auto ts = committed.load(std::memory_order_relaxed) + 1;
+        auto version = new Version{ts, val == nullptr, val ? *val : V{}, nullptr};
+        {
+            std::shared_lock<std::shared_mutex> lk(treeMtx);
+            auto cur = tree.find(key);
+            if (cur.valid()) {
+                auto chain = cur.val();
+                version->prev = chain->head.load(std::memory_order_relaxed);
+                chain->head.store(version, std::memory_order_release);
+                version = nullptr;
+            }
+        }
+        if (version) {
+            // writers are serialized, nobody else can add this key in between
+            std::unique_lock<std::shared_mutex> lk(treeMtx);
+            auto chain = new Chain;
+            chain->head.store(version, std::memory_order_relaxed);
+            tree.insert(key, chain);
+        }
+        committed.store(ts, std::memory_order_release);
+        return ts;
+    }
+
+public:
+    // RAII read timestamp, keeps every version visible at ts() alive
+    class Snapshot {
+        SnapshotSlot *slot;
+        uint64_t readTs;
+        friend class MvccBTreeMap;
+        Snapshot(SnapshotSlot *slot, uint64_t ts): slot(slot), readTs(ts) {}
+
+    public:
+        Snapshot(const Snapshot &) = delete;
+        Snapshot(Snapshot &&other): slot(other.slot), readTs(other.readTs) { other.slot = nullptr; }
+        ~Snapshot() {
+            if (slot) {
+                slot->ts.store(kFreeSlot, std::memory_order_release);
+            }
+        }
+        uint64_t ts() const { return readTs; }
+    };
+
+    MvccBTreeMap() = default;
+    MvccBTreeMap(const MvccBTreeMap &) = delete;
+
+    // Chains retired by collect() are left to ebr.h, they do not refer to the map and are freed
+    // by a later collect on their thread, or at its exit. Waiting for them here with ebr::flush()
+    // would wait for readers pinned anywhere in the process, not only for those of this map.
+    ~MvccBTreeMap() {
+        stop_gc();
+        tree.for_each([](const K &, Chain *const &chain) { reclaimChain(chain); });
+    }
+
+    // insert or overwrite, returns the commit timestamp
+    uint64_t put(const K &key, const V &val) {
+        return write(key, &val);
+    }
+
+    // writes a tombstone, returns the commit timestamp
+    uint64_t remove(const K &key) {
+        return write(key, nullptr);
+    }
+
+    // Waits for a free slot if kMaxSnapshots are live at once.
+    Snapshot snapshot() const {
+        while (true) {
+            auto ts = committed.load(std::memory_order_seq_cst);
+            for (auto &slot : slots) {
+                auto expected = kFreeSlot;
+                if (slot.ts.compare_exchange_strong(expected, ts, std::memory_order_seq_cst)) {
+                    // A collector that missed our slot has read `committed` before we published
+                    // it, so reading at the current committed timestamp is covered either way.
+                    return Snapshot(&slot, committed.load(std::memory_order_seq_cst));
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    std::optional<V> find(const K &key, const Snapshot &snap) const {
+        ebr::Guard guard;
+        Chain *chain;
+        {
+            std::shared_lock<std::shared_mutex> lk(treeMtx);
+            auto cur = tree.find(key);
+            if (!cur.valid()) {
+                return {};
+            }
+            chain = cur.val();
+        }
+        auto v = visible(chain, snap.ts());
+        if (!v || v->deleted) {
+            return {};
+        }
+        return v->val;
+    }
+
+    // In-order walk over the snapshot, fn(const K &, const V &). Writers are not held up by it,
+    // keys they add meanwhile show up or not depending on where the walk is.
+    template <typename Fn>
+    void for_each(const Snapshot &snap, Fn fn) const {
+        ebr::Guard guard;
+        walk([&](const K &key, Chain *chain) {
+            auto v = visible(chain, snap.ts());
+            if (v && !v->deleted) {
+                fn(key, v->val);
+            }
+        });
+    }
+
+    // Free versions no live or future snapshot can see, drop keys whose only version left is a
+    // tombstone behind the horizon. Returns the number of versions freed or retired.
+    size_t collect() {
+        std::lock_guard<std::mutex> clk(collectMtx);
+        auto horizon = committed.load(std::memory_order_seq_cst);
+        for (auto &slot : slots) {
+            horizon = std::min(horizon, slot.ts.load(std::memory_order_seq_cst));
+        }
+
+        size_t freed = 0;
+        std::vector<K> dead;
+        // chains are only ever dropped below, no guard needed
+        walk([&](const K &key, Chain *chain) {
+            // readers at or after the horizon stop at keep and never look behind it
+            auto keep = const_cast<Version *>(visible(chain, horizon));
+            if (!keep) {
+                return;
+            }
+            freed += freeChain(keep->prev);
+            keep->prev = nullptr;
+            if (keep->deleted && keep == chain->head.load(std::memory_order_acquire)) {
+                dead.push_back(key);
+            }
+        });
+        if (!dead.empty()) {
+            std::lock_guard<std::mutex> wlk(writeMtx);
+            std::unique_lock<std::shared_mutex> lk(treeMtx);
+            for (auto &key : dead) {
+                auto chain = tree.find(key).val();
+                auto head = chain->head.load(std::memory_order_relaxed);
+                // rewritten since the scan
+                if (head->prev || !head->deleted) {
+                    continue;
+                }
+                tree.remove(key);
+                // a snapshot walk may have picked up the chain before it was unlinked
+                ebr::retire(chain, reclaimChain);
+                freed++;
+            }
+        }
+        return freed;
+    }
+
+    // run collect() every interval on a background thread until stop_gc()
+    void start_gc(std::chrono::milliseconds interval) {
+        stop_gc();
+        gcStop = false;
+        gcThread = std::thread([this, interval]() {
+            std::unique_lock<std::mutex> lk(gcMtx);
+            while (!gcCond.wait_for(lk, interval, [this]() { return gcStop; })) {
+                lk.unlock();
+                collect();
+                lk.lock();
+            }
+        });
+    }
+
+    void stop_gc() {
+        if (!gcThread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(gcMtx);
+            gcStop = true;
+        }
+        gcCond.notify_all();
+        gcThread.join();
+    }
+};
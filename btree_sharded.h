@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+
+/**
+ * BTreeMap range-partitioned into shards, each a BTree behind its own reader-writer lock, so
+ * operations on different shards never contend. Shard boundaries live in a directory that every
+ * operation locks shared; it is locked exclusively only to split a shard that grew too large or
+ * took far more than its share of traffic, or to merge two neighbours that shrank too small.
+ *
+ * A seqlock is not offered for read-mostly shards: optimistic readers of a pointer-based tree
+ * would chase nodes freed under them.
+ */
+template <typename K, typename V, unsigned ORDER = 12, typename Cmp = decltype(std::less<K>{})>
+class ShardedBTreeMap {
+    using Tree = BTree<K, V, ORDER, Cmp>;
+
+    // padded so that neighbouring shard locks never share a cache line
+    struct alignas(64) Shard {
+        std::shared_mutex mtx;
+        Tree tree;
+        std::atomic<uint64_t> ops{0}; // accesses since the last rebalance
+    };
+
+    // ops on a single shard between two rebalance checks
+    static constexpr uint64_t kHotWindow = 1 << 16;
+    // a shard is hot when it takes this many times its fair share of ops
+    static constexpr unsigned kHotFactor = 2;
+
+    // Shard layout only, not content, so readers may rebalance through a const map too
+    mutable std::shared_mutex dirMtx;
+    mutable std::vector<std::unique_ptr<Shard>> shards;
+    mutable std::vector<K> bounds; // shards[i] holds keys in [bounds[i - 1], bounds[i])
+    size_t maxShardSize;
+
+    size_t shardIdx(const K &key) const {
+        return std::upper_bound(bounds.begin(), bounds.end(), key, Cmp()) - bounds.begin();
+    }
+
+    // count an access, true if it is time for a rebalance check
+    static bool touch(Shard &shard) {
+        return (shard.ops.fetch_add(1, std::memory_order_relaxed) + 1) % kHotWindow == 0;
+    }
+
+    static std::vector<std::pair<K, V>> drain(const Shard &shard) {
+        std::vector<std::pair<K, V>> entries;
+        entries.reserve(shard.tree.size());
+        shard.tree.for_each([&](const K &k, const V &v) { entries.emplace_back(k, v); });
+        return entries;
+    }
+
+    // caller holds dirMtx exclusively
+    void split(size_t idx) const {
+        auto entries = drain(*shards[idx]);
+        auto mid = entries.size() / 2;
+        auto upper = std::make_unique<Shard>();
+        upper->tree.bulk_load(entries.begin() + mid, entries.end());
+        shards[idx]->tree.bulk_load(entries.begin(), entries.begin() + mid);
+        bounds.insert(bounds.begin() + idx, entries[mid].first);
+        shards.insert(shards.begin() + idx + 1, std::move(upper));
+    }
+
+    // caller holds dirMtx exclusively
+    void merge(size_t idx) const {
+        auto entries = drain(*shards[idx]);
+        auto upper = drain(*shards[idx + 1]);
+        std::move(upper.begin(), upper.end(), std::back_inserter(entries));
+        shards[idx]->tree.bulk_load(entries.begin(), entries.end());
+        bounds.erase(bounds.begin() + idx);
+        shards.erase(shards.begin() + idx + 1);
+    }
+
+public:
+    // initial bounds have to be sorted, more shards are split off as the data grows
+    explicit ShardedBTreeMap(std::vector<K> initialBounds = {}, size_t maxShardSize = 1 << 16)
+        : bounds(std::move(initialBounds)), maxShardSize(std::max<size_t>(maxShardSize, 4 * ORDER)) {
+        for (size_t i = 0; i <= bounds.size(); i++) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    // insert or overwrite, true if key was not there before
+    bool insert(const K &key, const V &val = {}) {
+        bool inserted, check;
+        {
+            std::shared_lock<std::shared_mutex> dir(dirMtx);
+            auto &shard = *shards[shardIdx(key)];
+            std::unique_lock<std::shared_mutex> lk(shard.mtx);
+            auto cur = shard.tree.find(key);
+            inserted = !cur.valid();
+            if (inserted) {
+                shard.tree.insert(key, val);
+            } else {
+                cur.val() = val;
+            }
+            check = touch(shard) || shard.tree.size() > maxShardSize;
+        }
+        if (check) {
+            rebalance();
+        }
+        return inserted;
+    }
+
+    bool remove(const K &key) {
+        bool removed, check;
+        {
+            std::shared_lock<std::shared_mutex> dir(dirMtx);
+            auto &shard = *shards[shardIdx(key)];
+            std::unique_lock<std::shared_mutex> lk(shard.mtx);
+            removed = shard.tree.remove(key);
+            check = touch(shard) || (removed && shard.tree.size() + 1 == maxShardSize / 8);
+        }
+        if (check) {
+            rebalance();
+        }
+        return removed;
+    }
+
+    // counts towards the shard getting hot like writes do, so read-hot shards split as well
+    std::optional<V> find(const K &key) const {
+        std::optional<V> ret;
+        bool check;
+        {
+            std::shared_lock<std::shared_mutex> dir(dirMtx);
+            auto &shard = *shards[shardIdx(key)];
+            std::shared_lock<std::shared_mutex> lk(shard.mtx);
+            check = touch(shard);
+            auto cur = shard.tree.find(key);
+            if (cur.valid()) {
+                ret = cur.val();
+            }
+        }
+        if (check) {
+            rebalance();
+        }
+        return ret;
+    }
+
+    // Ordered walk across all shards, fn(const K &, const V &). Each shard is read under its own
+    // lock, so this is not a snapshot of the whole map.
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        std::shared_lock<std::shared_mutex> dir(dirMtx);
+        for (auto &shard : shards) {
+            std::shared_lock<std::shared_mutex> lk(shard->mtx);
+            shard->tree.for_each(fn);
+        }
+    }
+
+    // ordered walk over lo <= key < hi, same consistency as for_each
+    template <typename Fn>
+    void range_scan(const K &lo, const K &hi, Fn fn) const {
+        std::shared_lock<std::shared_mutex> dir(dirMtx);
+        for (auto i = shardIdx(lo); i <= shardIdx(hi) && i < shards.size(); i++) {
+            std::shared_lock<std::shared_mutex> lk(shards[i]->mtx);
+            shards[i]->tree.range_scan(lo, hi, fn);
+        }
+    }
+
+    // Split shards that are too large or hot (at least kHotFactor times their fair share of the
+    // recent ops), then merge cold neighbours that together fit in a quarter of maxShardSize.
+    // Called automatically from insert, remove and find.
+    void rebalance() const {
+        std::unique_lock<std::shared_mutex> dir(dirMtx);
+        uint64_t total = 0;
+        for (auto &shard : shards) {
+            total += shard->ops.load(std::memory_order_relaxed);
+        }
+        auto fair = total / shards.size();
+        for (size_t i = 0; i < shards.size(); i++) {
+            auto &shard = *shards[i];
+            bool hot = fair && shard.ops.load(std::memory_order_relaxed) >= kHotFactor * fair;
+            if (shard.tree.size() > maxShardSize || (hot && shard.tree.size() >= 4 * ORDER)) {
+                split(i++);
+            }
+        }
+        for (size_t i = 0; i + 1 < shards.size();) {
+            bool cold = shards[i]->ops.load(std::memory_order_relaxed) <= fair &&
+                        shards[i + 1]->ops.load(std::memory_order_relaxed) <= fair;
+            if (cold && shards[i]->tree.size() + shards[i + 1]->tree.size() < maxShardSize / 4) {
+                merge(i);
+            } else {
+                i++;
+            }
+        }
+        for (auto &shard : shards) {
+            shard->ops.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> dir(dirMtx);
+        size_t ret = 0;
+        for (auto &shard : shards) {
+            std::shared_lock<std::shared_mutex> lk(shard->mtx);
+            ret += shard->tree.size();
+        }
+        return ret;
+    }
+
+    size_t shard_count() const {
+        std::shared_lock<std::shared_mutex> dir(dirMtx);
+        return shards.size();
+    }
+};
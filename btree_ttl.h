@@ -0,0 +1,132 @@
+#pragma once
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+#include "hwstat.h"
+
+COUNTER(ttlEvicted, "entries evicted by ExpiringBTreeMap::expire_until", inline);
+COUNTER(ttlRebuilds, "expire_until calls that rebuilt the map instead of removing keys", inline);
+
+/**
+ * BTreeMap whose entries carry an expiry time, paired with a secondary index ordered by that
+ * time. An entry put with expiry t is live while now < t.
+ *
+ * expire_until(now) finds everything due as a prefix of the index and cuts it off with
+ * erase_prefix(), which drops whole subtrees and only rebalances along the cut. The primary map
+ * is ordered by key, not by expiry, so the same entries are scattered all over it and there is
+ * no range to cut there. With d entries due out of n:
+ *   - d * 8 <= n: each due key is removed on its own, O(d log n).
+ *   - d * 8 > n: the survivors are bulk loaded into a fresh map, O(n) with no rebalancing. This
+ *     shows up in the ttlRebuilds hwstat counter.
+ * Evictions show up in ttlEvicted.
+ */
+template <typename K, typename V, typename Time = uint64_t, unsigned ORDER = 12,
+          typename Cmp = decltype(std::less<K>{})>
+class ExpiringBTreeMap {
+    struct Entry {
+        V val;
+        Time expires;
+    };
+
+    // a missing key stands for the end of its instant, so {t, {}} bounds everything due by t
+    struct ExpiryKey {
+        Time at;
+        std::optional<K> key;
+    };
+
+    struct ExpiryCmp {
+        bool operator()(const ExpiryKey &a, const ExpiryKey &b) const {
+            if (a.at < b.at || b.at < a.at) {
+                return a.at < b.at;
+            }
+            if (!a.key || !b.key) {
+                return a.key && !b.key;
+            }
+            return Cmp()(*a.key, *b.key);
+        }
+    };
+
+    BTreeMap<K, Entry, ORDER, Cmp> entries;
+    BTreeSet<ExpiryKey, ORDER, ExpiryCmp> index;
+
+public:
+    // insert or overwrite, the entry expires at `expires`
+    void put(const K &key, const V &val, Time expires) {
+        auto cur = entries.find(key);
+        if (cur.valid()) {
+            index.remove({cur.val().expires, key});
+            cur.val() = {val, expires};
+        } else {
+            entries.insert(key, {val, expires});
+        }
+        index.insert({expires, key});
+    }
+
+    bool erase(const K &key) {
+        auto cur = entries.find(key);
+        if (!cur.valid()) {
+            return false;
+        }
+        index.remove({cur.val().expires, key});
+        entries.remove(key);
+        return true;
+    }
+
+    // value of key, unless it is gone or expired by now
+    std::optional<V> find(const K &key, Time now) const {
+        auto cur = entries.find(key);
+        if (!cur.valid() || !(now < cur.val().expires)) {
+            return {};
+        }
+        return cur.val().val;
+    }
+
+    // expiry time of key, expired or not
+    std::optional<Time> expiry(const K &key) const {
+        auto cur = entries.find(key);
+        if (!cur.valid()) {
+            return {};
+        }
+        return cur.val().expires;
+    }
+
+    // evict every entry with expiry <= now, returns how many
+    size_t expire_until(Time now) {
+        auto first = index.front();
+        ExpiryKey bound{now, std::nullopt};
+        if (!first.valid() || !ExpiryCmp()(first.key(), bound)) {
+            return 0;
+        }
+        std::vector<K> due;
+        index.range_scan(first.key(), bound, [&due](const ExpiryKey &k, const std::tuple<> &) {
+            due.push_back(*k.key);
+        });
+        index.erase_prefix(bound);
+
+        if (due.size() * 8 > entries.size()) {
+            std::vector<std::pair<K, Entry>> live;
+            live.reserve(entries.size() - due.size());
+            entries.for_each([&](const K &k, const Entry &e) {
+                if (now < e.expires) {
+                    live.emplace_back(k, e);
+                }
+            });
+            entries.bulk_load(live.begin(), live.end());
+            ttlRebuilds++;
+        } else {
+            for (auto &key : due) {
+                entries.remove(key);
+            }
+        }
+        ttlEvicted += due.size();
+        return due.size();
+    }
+
+    // live and not yet evicted entries
+    size_t size() const {
+        return entries.size();
+    }
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Minimal C++20 coroutines for interleaving memory-bound operations.
+ *
+ * A Task<T> is a lazily started coroutine that suspends wherever it would otherwise stall on a
+ * cache miss: issue a prefetch, then `co_await coro::yield()`. A scheduler such as interleave()
+ * resumes a batch of tasks round robin, so by the time a task runs again its data has arrived
+ * and the misses of all tasks in flight overlap.
+ *
+ * Tasks compose: a task may co_await another task, which then runs inline in the same slot of
+ * the scheduler, yield points included. Per-request control flow is thus ordinary code.
+ */
+namespace coro {
+
+namespace detail {
+
+// Frames are allocated and freed at the rate of lookups, recycle them per thread.
+class FramePool {
+    static constexpr size_t kGrain = 64;
+    static constexpr size_t kClasses = 16;
+
+    struct FreeFrame {
+        FreeFrame *next;
+    };
+
+    FreeFrame *lists[kClasses] = {};
+
+    static size_t classOf(size_t n) {
+        return (n + kGrain - 1) / kGrain - 1;
+    }
+
+public:
+    ~FramePool() {
+        for (auto &list : lists) {
+            while (list) {
+                auto next = list->next;
+                ::operator delete(list);
+                list = next;
+            }
+        }
+    }
+
+    static FramePool &local() {
+        static thread_local FramePool pool;
+        return pool;
+    }
+
+    void *alloc(size_t n) {
+        auto c = classOf(n);
+        if (c >= kClasses) {
+            return ::operator new(n);
+        }
+        if (auto frame = lists[c]) {
+            lists[c] = frame->next;
+            return frame;
+        }
+        return ::operator new((c + 1) * kGrain);
+    }
+
+    void free(void *p, size_t n) {
+        auto c = classOf(n);
+        if (c >= kClasses) {
+            ::operator delete(p);
+            return;
+        }
+        lists[c] = new (p) FreeFrame{lists[c]};
+    }
+};
+
+// a finished task passes control straight back to the task awaiting it, if any
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        auto &self = h.promise();
+        if (!self.continuation) {
+            return std::noop_coroutine();
+        }
+        self.root->active = self.continuation;
+        return self.continuation;
+    }
+
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation; // the awaiting task, none for a top-level one
+    PromiseBase *root = this;             // top-level promise of the chain of awaiting tasks
+    std::coroutine_handle<> active;       // root only: the innermost task, resumed next
+    std::exception_ptr error;
+
+    static void *operator new(size_t n) {
+        return FramePool::local().alloc(n);
+    }
+
+    static void operator delete(void *p, size_t n) {
+        FramePool::local().free(p, n);
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+};
+
+} // namespace detail
+
+template <typename T>
+class Task {
+public:
+    struct promise_type : detail::PromiseBase {
+        std::optional<T> result;
+
+        Task get_return_object() {
+            auto h = std::coroutine_handle<promise_type>::from_promise(*this);
+            active = h;
+            return Task(h);
+        }
+
+        template <typename U>
+        void return_value(U &&val) {
+            result.emplace(std::forward<U>(val));
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle): handle(handle) {}
+
+public:
+    Task(): handle(nullptr) {}
+    Task(const Task &) = delete;
+    Task(Task &&other) noexcept: handle(std::exchange(other.handle, nullptr)) {}
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    // an empty Task (default constructed or moved from) has nothing left to run
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    // run until the next yield point of whichever task in the chain is innermost
+    void resume() {
+        assert(handle && !handle.done());
+        handle.promise().active.resume();
+    }
+
+    // run to completion, without interleaving
+    T &get() {
+        while (!done()) {
+            resume();
+        }
+        return result();
+    }
+
+    // only once done(), rethrows what escaped the coroutine
+    T &result() {
+        assert(handle && handle.done());
+        auto &p = handle.promise();
+        if (p.error) {
+            std::rethrow_exception(p.error);
+        }
+        return *p.result;
+    }
+
+    // awaited by another task: run inline, in the awaiting task's place in the scheduler
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> parent) noexcept {
+        assert(handle);
+        auto &self = handle.promise();
+        self.continuation = parent;
+        self.root = parent.promise().root;
+        self.root->active = handle;
+        return handle;
+    }
+
+    T await_resume() {
+        return std::move(result());
+    }
+};
+
+// suspension point of a task, typically right after a prefetch
+inline std::suspend_always yield() {
+    return {};
+}
+
+/**
+ * Run make(i) for i in [0, n) with up to width tasks in flight, resuming them round robin.
+ * A finished task hands its result to done(i, result) and its slot to the next one.
+ * The right width is roughly the number of outstanding misses a core sustains, 8 to 16;
+ * a width of 0 runs the tasks one at a time like 1 does.
+ */
+template <typename Make, typename Done>
+void interleave(size_t width, size_t n, Make make, Done done) {
+    using TaskT = std::invoke_result_t<Make &, size_t>;
+    width = std::max<size_t>(width, 1);
+    struct Slot {
+        TaskT task;
+        size_t idx;
+    };
+    std::vector<Slot> slots;
+    slots.reserve(std::min(width, n));
+    size_t next = 0;
+    for (; next < n && slots.size() < width; next++) {
+        slots.push_back({make(next), next});
+    }
+    while (!slots.empty()) {
+        for (size_t s = 0; s < slots.size();) {
+            auto &slot = slots[s];
+            slot.task.resume();
+            if (!slot.task.done()) {
+                s++;
+                continue;
+            }
+            done(slot.idx, slot.task.result());
+            if (next < n) {
+                slot = {make(next), next};
+                next++;
+                s++;
+            } else {
+                slot = std::move(slots.back());
+                slots.pop_back();
+            }
+        }
+    }
+}
+
+} // namespace coro
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Epoch-based memory reclamation.
+ *
+ * Readers wrap every traversal of a shared structure in an ebr::Guard. Writers unlink an object
+ * first and then retire() it instead of freeing it; it is freed once every reader that might
+ * still hold a pointer to it has left its guard. Readers only ever write their own record, no
+ * reference counts, no shared cache line.
+ *
+ * There is one global epoch. A guard pins the thread at the epoch it sees on entry; the epoch
+ * advances only while every pinned thread is at the current one. An object retired at epoch e
+ * was unreachable to anybody pinning later than that, so once the epoch reached e + 2 all
+ * readers that could have seen it are gone. Retired objects sit on per-thread lists in retire
+ * order and are reclaimed in batches every kBatch retirements.
+ *
+ * A thread that pins forever stalls reclamation (not correctness) for everybody; keep guards
+ * short. A thread that exits reclaims what is due and hands the rest over to whichever thread
+ * collects next; leftovers at process exit are reclaimed during static destruction.
+ */
+namespace ebr {
+
+class Domain {
+public:
+    static constexpr size_t kBatch = 64;
+
+private:
+    static constexpr uint64_t kIdle = std::numeric_limits<uint64_t>::max();
+
+    // one per thread, reused after the thread exits, never freed
+    struct alignas(64) Record {
+        std::atomic<uint64_t> epoch{kIdle};
+        std::atomic<bool> used{true};
+        Record *next{nullptr};
+    };
+
+    struct Retired {
+        void *ptr;
+        void (*reclaim)(void *);
+        uint64_t epoch;
+    };
+
+    struct Local {
+        Record *rec;
+        unsigned depth = 0;
+        bool collecting = false;
+        size_t sinceCollect = 0;
+        std::vector<Retired> limbo; // ascending epochs
+
+        Local(): rec(acquireRecord()) {}
+
+        ~Local() {
+            assert(depth == 0);
+            rec->epoch.store(kIdle, std::memory_order_release);
+            // reclaim what is due already, only the rest waits for another thread to collect
+            reclaim(limbo, tryAdvance());
+            if (!limbo.empty()) {
+                std::lock_guard<std::mutex> lk(orphanMtx);
+                orphans.list.insert(orphans.list.end(), limbo.begin(), limbo.end());
+                hasOrphans.store(true, std::memory_order_relaxed);
+            }
+            rec->used.store(false, std::memory_order_release);
+        }
+    };
+
+    // Objects left by exited threads. Whatever is still there at static destruction (the main
+    // thread's leftovers at least) is reclaimed then, as far as threads still pinned allow.
+    struct Orphans {
+        std::vector<Retired> list;
+
+        ~Orphans() {
+            std::lock_guard<std::mutex> lk(orphanMtx);
+            // a pinned thread keeps the epoch from moving, two steps do it otherwise
+            for (int i = 0; i < 3 && !list.empty(); i++) {
+                auto epoch = tryAdvance();
+                auto due = std::stable_partition(list.begin(), list.end(),
+                                                 [epoch](const Retired &r) { return r.epoch + 2 <= epoch; });
+                std::vector<Retired> adopted(list.begin(), due);
+                list.erase(list.begin(), due);
+                for (auto &r : adopted) {
+                    r.reclaim(r.ptr);
+                }
+            }
+        }
+    };
+
+    static inline std::atomic<uint64_t> global{0};
+    static inline std::atomic<Record *> records{nullptr};
+    static inline std::mutex orphanMtx;
+    static inline Orphans orphans;
+    static inline std::atomic<bool> hasOrphans{false};
+
+    static Record *acquireRecord() {
+        for (auto rec = records.load(std::memory_order_acquire); rec; rec = rec->next) {
+            bool expected = false;
+            if (!rec->used.load(std::memory_order_relaxed) &&
+                rec->used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return rec;
+            }
+        }
+        auto rec = new Record;
+        auto head = records.load(std::memory_order_relaxed);
+        do {
+            rec->next = head;
+        } while (!records.compare_exchange_weak(head, rec, std::memory_order_release, std::memory_order_relaxed));
+        return rec;
+    }
+
+    static Local &local() {
+        static thread_local Local l;
+        return l;
+    }
+
+    // advance the global epoch if every pinned thread has caught up with it
+    static uint64_t tryAdvance() {
+        auto e = global.load(std::memory_order_seq_cst);
+        for (auto rec = records.load(std::memory_order_acquire); rec; rec = rec->next) {
+            auto pinned = rec->epoch.load(std::memory_order_seq_cst);
+            if (pinned != kIdle && pinned != e) {
+                return e;
+            }
+        }
+        if (global.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst)) {
+            return e + 1;
+        }
+        return e;
+    }
+
+    // Run the reclaimers of everything retired before epoch - 1, removed from the list first as
+    // reclaimers may retire more.
+    static void reclaim(std::vector<Retired> &list, uint64_t epoch) {
+        size_t n = 0;
+        while (n < list.size() && list[n].epoch + 2 <= epoch) {
+            n++;
+        }
+        if (n == 0) {
+            return;
+        }
+        std::vector<Retired> due(list.begin(), list.begin() + n);
+        list.erase(list.begin(), list.begin() + n);
+        for (auto &r : due) {
+            r.reclaim(r.ptr);
+        }
+    }
+
+    static void collect(Local &l) {
+        if (l.collecting) {
+            return;
+        }
+        l.collecting = true;
+        l.sinceCollect = 0;
+        auto epoch = tryAdvance();
+        reclaim(l.limbo, epoch);
+        if (hasOrphans.load(std::memory_order_relaxed)) {
+            std::vector<Retired> adopted;
+            {
+                std::lock_guard<std::mutex> lk(orphanMtx);
+                // orphans of several threads interleave, due ones are not just a prefix
+                auto due = std::stable_partition(orphans.list.begin(), orphans.list.end(),
+                                                 [epoch](const Retired &r) { return r.epoch + 2 <= epoch; });
+                adopted.assign(orphans.list.begin(), due);
+                orphans.list.erase(orphans.list.begin(), due);
+                hasOrphans.store(!orphans.list.empty(), std::memory_order_relaxed);
+            }
+            reclaim(adopted, epoch);
+        }
+        l.collecting = false;
+    }
+
+public:
+    static void pin() {
+        auto &l = local();
+        if (l.depth++ == 0) {
+            // a collector either sees us pinned or we see everything unlinked before it looked
+            l.rec->epoch.store(global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void unpin() {
+        auto &l = local();
+        assert(l.depth > 0);
+        if (--l.depth == 0) {
+            l.rec->epoch.store(kIdle, std::memory_order_release);
+        }
+    }
+
+    // ptr has to be unreachable for readers entering a guard from now on
+    static void retire(void *ptr, void (*reclaimFn)(void *)) {
+        auto &l = local();
+        l.limbo.push_back({ptr, reclaimFn, global.load(std::memory_order_seq_cst)});
+        if (++l.sinceCollect >= kBatch) {
+            collect(l);
+        }
+    }
+
+    // Wait until every guard entered before the call is left, then reclaim everything this
+    // thread (and exited threads) retired so far. Must not be called inside a guard. Guards of
+    // every thread in the process count, whatever they are reading, so this stalls behind any
+    // long one; not for destructors of a single structure.
+    static void flush() {
+        auto &l = local();
+        assert(l.depth == 0);
+        auto target = global.load(std::memory_order_seq_cst) + 2;
+        while (true) {
+            auto epoch = tryAdvance();
+            if (epoch >= target) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        // reclaimers may retire more, which become due two epochs later
+        while (!l.limbo.empty() || hasOrphans.load(std::memory_order_relaxed)) {
+            collect(l);
+            std::this_thread::yield();
+        }
+    }
+
+    static uint64_t epoch() {
+        return global.load(std::memory_order_relaxed);
+    }
+
+    // objects retired by this thread and not reclaimed yet
+    static size_t pending() {
+        return local().limbo.size();
+    }
+};
+
+// RAII read-side critical section, nests
+class Guard {
+public:
+    Guard() { Domain::pin(); }
+    ~Guard() { Domain::unpin(); }
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+};
+
+inline void retire(void *ptr, void (*reclaim)(void *)) {
+    Domain::retire(ptr, reclaim);
+}
+
+template <typename T>
+void retire(T *ptr) {
+    Domain::retire(ptr, [](void *p) { delete static_cast<T *>(p); });
+}
+
+inline void flush() {
+    Domain::flush();
+}
+
+} // namespace ebr
@@ -0,0 +1,90 @@
+// Checks for btree_intrusive.h: ranks, select and range aggregates against std::map.
+#include <map>
+#include <random>
+
+#include "btree_intrusive.h"
+#include "check.h"
+
+// first entry of ref in the range with lo as given, one past the last with hi as given
+static std::map<int, int>::const_iterator lowerOf(const std::map<int, int> &ref, int lo, bool inclusive) {
+    return inclusive ? ref.lower_bound(lo) : ref.upper_bound(lo);
+}
+
+static std::map<int, int>::const_iterator upperOf(const std::map<int, int> &ref, int hi, bool inclusive) {
+    return inclusive ? ref.upper_bound(hi) : ref.lower_bound(hi);
+}
+
+// Random inserts, removes and updates against std::map, checking the structure, ranks,
+// select() and next(), count_range() and aggregate_range() with all four bound combinations.
+template <unsigned ORDER, typename Count, typename Agg>
+static void testRandomOps() {
+    for (int seed = 0; seed < 20; seed++) {
+        std::mt19937 rng(seed);
+        IntrusiveBTree<int, int, ORDER, std::less<int>, Count, Agg> t;
+        std::map<int, int> ref;
+        int keys = seed % 4 == 0 ? 30 : 3000;
+        for (int round = 0; round < 20; round++) {
+            for (int i = 0; i < 300; i++) {
+                int k = rng() % keys;
+                int v = int(rng() % 2001) - 1000;
+                auto op = rng() % 4;
+                if (op == 0) {
+                    CHECK(t.remove(k) == (ref.erase(k) > 0));
+                } else if (op == 1 && ref.count(k)) {
+                    auto cursor = t.find(k);
+                    CHECK(cursor.valid());
+                    t.update(cursor, v);
+                    ref[k] = v;
+                } else if (ref.emplace(k, v).second) {
+                    t.insert(k, v);
+                }
+            }
+            t.traverse();
+            CHECK(t.size() == ref.size());
+
+            // select(0) and next() walk all entries in order
+            auto cursor = t.select(0);
+            for (auto &[k, v] : ref) {
+                CHECK(cursor.valid() && cursor.key() == k && cursor.val() == v);
+                cursor.next();
+            }
+            CHECK(!cursor.valid());
+            CHECK(!t.select(Count(ref.size())).valid());
+
+            for (int i = 0; i < 50; i++) {
+                if (!ref.empty()) {
+                    Count r = rng() % ref.size();
+                    auto it = std::next(ref.begin(), r);
+                    auto at = t.select(r);
+                    CHECK(at.valid() && at.key() == it->first);
+                    CHECK(t.getRank(it->first) == r);
+                }
+                int lo = int(rng() % (keys + 20)) - 10;
+                int hi = rng() % 8 == 0 ? lo : int(rng() % (keys + 20)) - 10;
+                for (int b = 0; b < 4; b++) {
+                    bool loIn = b & 1, hiIn = b & 2;
+                    auto first = lowerOf(ref, lo, loIn), last = upperOf(ref, hi, hiIn);
+                    Count n = 0;
+                    auto acc = Agg::identity();
+                    if (lo < hi || (lo == hi && loIn && hiIn)) {
+                        for (auto it = first; it != last; ++it) {
+                            acc = Agg::combine(acc, Agg::of(it->first, it->second));
+                            n++;
+                        }
+                    }
+                    CHECK(t.count_range(lo, hi, loIn, hiIn) == n);
+                    CHECK(t.aggregate_range(lo, hi, loIn, hiIn) == acc);
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    testRandomOps<8, uint16_t, BTreeSum<long>>();
+    testRandomOps<10, uint32_t, BTreeMin<int>>();
+    testRandomOps<12, uint64_t, BTreeMax<int>>();
+    testRandomOps<16, uint32_t, BTreeSum<long>>();
+    testRandomOps<5, uint16_t, BTreeMin<int>>();
+    puts("ok");
+}
@@ -0,0 +1,150 @@
+// Checks for btree_leftright.h: both instances kept alike, readers against a busy writer.
+#include <atomic>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "btree_leftright.h"
+#include "check.h"
+
+// both instances have to go through the same updates
+static void testAgainstMap() {
+    LeftRightBTreeMap<int, int> m;
+    std::map<int, int> ref;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 20000; i++) {
+        int k = rng() % 1000;
+        if (rng() % 3 == 0) {
+            CHECK(m.remove(k) == (ref.erase(k) > 0));
+        } else {
+            m.put(k, i);
+            ref[k] = i;
+        }
+        if (i % 1000 == 0) {
+            for (int j = 0; j < 2; j++) {
+                // every other read lands on the other instance after a write
+                m.put(-1, j);
+                m.remove(-1);
+                CHECK(m.size() == ref.size());
+                m.read([&](const BTreeMap<int, int> &map) {
+                    auto it = ref.begin();
+                    map.for_each([&](const int &k, const int &v) {
+                        CHECK(it != ref.end() && it->first == k && it->second == v);
+                        ++it;
+                    });
+                    CHECK(it == ref.end());
+                });
+            }
+        }
+    }
+}
+
+// an update throwing on either instance leaves both alike, with or without the update
+static void testThrowingUpdate() {
+    LeftRightBTreeMap<int, int> m;
+    for (int k = 0; k < 100; k++) {
+        m.put(k, k);
+    }
+    // both instances are read in turn, with a write in between that flips them
+    auto checkBoth = [&m](size_t n, int at50) {
+        for (int j = 0; j < 2; j++) {
+            CHECK(m.size() == n);
+            CHECK(m.find(50) == at50);
+            m.put(-1, j);
+            m.remove(-1);
+        }
+    };
+    for (int throwOn = 1; throwOn <= 2; throwOn++) {
+        int calls = 0;
+        bool thrown = false;
+        try {
+            m.update([&](BTreeMap<int, int> &map) {
+                map.find(50).val() = -throwOn;
+                map.insert(1000 + throwOn, 0);
+                if (++calls == throwOn) {
+                    throw std::runtime_error("update failed");
+                }
+            });
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        CHECK(thrown);
+        // dropped if thrown on the first instance, in effect if on the second
+        if (throwOn == 1) {
+            checkBoth(100, 50);
+        } else {
+            checkBoth(101, -2);
+        }
+    }
+}
+
+// A writer publishes as fast as it can, each update setting all of kKeys keys to the next
+// generation and moving one more key in or out. Readers have to see one generation across a
+// whole read, and never an older one than they saw before.
+static void testConcurrent() {
+    static constexpr int kKeys = 16;
+    static constexpr int kUpdates = 5000;
+    LeftRightBTreeMap<int, int> m;
+    for (int k = 0; k < kKeys; k++) {
+        m.put(k, 0);
+    }
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&m, &stop, r]() {
+            std::mt19937 rng(r);
+            int seen = 0;
+            while (!stop) {
+                if (rng() % 2) {
+                    int gen = m.read([](const BTreeMap<int, int> &map) {
+                        auto cur = map.find(0);
+                        CHECK(cur.valid());
+                        int gen = cur.val();
+                        size_t n = 0;
+                        map.for_each([&](const int &k, const int &v) {
+                            // keys past kKeys mark the generation they were put in
+                            CHECK(v == gen || (k >= kKeys && v == k - kKeys));
+                            n++;
+                        });
+                        CHECK(n == kKeys + (gen + 1) / 2);
+                        return gen;
+                    });
+                    CHECK(gen >= seen);
+                    seen = gen;
+                } else {
+                    auto v = m.find(rng() % kKeys);
+                    CHECK(v && *v >= seen);
+                    CHECK(m.contains(0));
+                }
+                // the threads take turns on machines with fewer cores than threads
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (int gen = 1; gen <= kUpdates; gen++) {
+        m.update([gen](BTreeMap<int, int> &map) {
+            for (int k = 0; k < kKeys; k++) {
+                map.find(k).val() = gen;
+            }
+            // every odd generation adds a key, so the entry count tells the generation too
+            if (gen % 2) {
+                map.insert(kKeys + gen, gen);
+            }
+        });
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (auto &t : readers) {
+        t.join();
+    }
+    CHECK(m.size() == kKeys + (kUpdates + 1) / 2);
+}
+
+int main() {
+    testAgainstMap();
+    testThrowingUpdate();
+    testConcurrent();
+    puts("ok");
+}
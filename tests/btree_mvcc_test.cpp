@@ -0,0 +1,139 @@
+// Checks for btree_mvcc.h: snapshot reads, writers during scans and garbage collection.
+#include <future>
+#include <map>
+#include <random>
+#include <thread>
+
+#include "btree_mvcc.h"
+#include "check.h"
+
+// a snapshot keeps seeing what was committed when it was taken
+static void testSnapshots() {
+    MvccBTreeMap<int, int> m;
+    m.put(1, 10);
+    m.put(2, 20);
+    auto before = m.snapshot();
+    m.put(1, 11);
+    m.remove(2);
+    m.put(3, 30);
+    auto after = m.snapshot();
+
+    CHECK(m.find(1, before) == 10);
+    CHECK(m.find(2, before) == 20);
+    CHECK(!m.find(3, before));
+    CHECK(m.find(1, after) == 11);
+    CHECK(!m.find(2, after));
+    CHECK(m.find(3, after) == 30);
+
+    std::map<int, int> seen;
+    m.for_each(before, [&](const int &k, const int &v) { seen[k] = v; });
+    CHECK((seen == std::map<int, int>{{1, 10}, {2, 20}}));
+
+    // `before` still pins the old versions, the tombstone of 2 is not dropped
+    m.collect();
+    CHECK(m.find(2, before) == 20);
+}
+
+// a writer adding a key must not wait for a snapshot scan in progress
+static void testWriterDuringScan() {
+    MvccBTreeMap<int, int> m;
+    for (int i = 0; i < 10000; i += 2) {
+        m.put(i, i);
+    }
+    auto snap = m.snapshot();
+    std::future<uint64_t> writer;
+    bool waited = false;
+    size_t n = 0;
+    m.for_each(snap, [&](const int &k, const int &) {
+        if (n++ == 0) {
+            // fresh key, with the scan stopped in its callback
+            writer = std::async(std::launch::async, [&m]() { return m.put(5001, 1); });
+            waited = writer.wait_for(std::chrono::seconds(5)) != std::future_status::ready;
+        }
+        CHECK(k % 2 == 0);
+    });
+    writer.get();
+    CHECK(!waited);
+    CHECK(n == 5000);
+    CHECK(!m.find(5001, snap));
+    CHECK(m.find(5001, m.snapshot()) == 1);
+}
+
+// concurrent writers, scans and garbage collection; scans of one snapshot agree with lookups
+static void testConcurrent() {
+    constexpr int kKeys = 300;
+    MvccBTreeMap<int, long> m;
+    m.start_gc(std::chrono::milliseconds(1));
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> writers, readers;
+    for (int w = 0; w < 2; w++) {
+        writers.emplace_back([&m, w]() {
+            std::mt19937 rng(w);
+            for (int i = 0; i < 50000; i++) {
+                int k = rng() % kKeys;
+                if (rng() % 5 == 0) {
+                    m.remove(k);
+                } else {
+                    m.put(k, i);
+                }
+            }
+        });
+    }
+    for (int r = 0; r < 2; r++) {
+        readers.emplace_back([&m, &stop]() {
+            while (!stop) {
+                auto snap = m.snapshot();
+                std::map<int, long> scanned, found;
+                m.for_each(snap, [&](const int &k, const long &v) { scanned[k] = v; });
+                for (int k = 0; k < kKeys; k++) {
+                    if (auto v = m.find(k, snap)) {
+                        found[k] = *v;
+                    }
+                }
+                CHECK(scanned == found);
+            }
+        });
+    }
+    for (auto &t : writers) {
+        t.join();
+    }
+    stop = true;
+    for (auto &t : readers) {
+        t.join();
+    }
+    m.stop_gc();
+}
+
+// a reader pinned on something else entirely must not hold up the destruction of a map
+static void testDestroyWhilePinned() {
+    std::promise<void> pinned, release;
+    std::thread reader([&]() {
+        ebr::Guard guard;
+        pinned.set_value();
+        release.get_future().wait();
+    });
+    pinned.get_future().wait();
+    auto destroyed = std::async(std::launch::async, []() {
+        MvccBTreeMap<int, int> m;
+        m.start_gc(std::chrono::milliseconds(1));
+        // dead keys, so that collect() retires their chains
+        for (int i = 0; i < 1000; i++) {
+            m.put(i, i);
+            m.remove(i);
+        }
+        CHECK(m.collect() > 0);
+    });
+    bool waited = destroyed.wait_for(std::chrono::seconds(5)) != std::future_status::ready;
+    release.set_value();
+    reader.join();
+    destroyed.get();
+    CHECK(!waited);
+}
+
+int main() {
+    testSnapshots();
+    testWriterDuringScan();
+    testConcurrent();
+    testDestroyWhilePinned();
+    puts("ok");
+}
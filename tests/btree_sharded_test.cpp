@@ -0,0 +1,143 @@
+// Checks for btree_sharded.h: shard splits and merges, alone and under concurrent readers.
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "btree_sharded.h"
+#include "check.h"
+
+// single threaded against std::map, through enough splits and merges
+static void testAgainstMap() {
+    ShardedBTreeMap<int, int> m({1000, 2000}, 64);
+    std::map<int, int> ref;
+    std::mt19937 rng(1);
+    for (int phase = 0; phase < 6; phase++) {
+        // grow, then shrink to a few entries
+        for (int i = 0; i < 20000; i++) {
+            int k = rng() % 4000;
+            if (phase % 2 == 0 ? rng() % 4 != 0 : rng() % 8 == 0) {
+                CHECK(m.insert(k, i) == ref.insert_or_assign(k, i).second);
+            } else {
+                CHECK(m.remove(k) == (ref.erase(k) > 0));
+            }
+        }
+        CHECK(m.size() == ref.size());
+        auto it = ref.begin();
+        m.for_each([&](const int &k, const int &v) {
+            CHECK(it != ref.end() && it->first == k && it->second == v);
+            ++it;
+        });
+        CHECK(it == ref.end());
+        for (int k = 0; k < 4000; k += 7) {
+            auto v = m.find(k);
+            auto r = ref.find(k);
+            CHECK(v.has_value() == (r != ref.end()));
+            CHECK(!v || *v == r->second);
+        }
+    }
+}
+
+// a shard that only takes reads splits once it is hot enough
+static void testReadHotSplit() {
+    // small enough a bound that the cold shards do not merge meanwhile
+    ShardedBTreeMap<int, int> m({500, 1000, 1500}, 1024);
+    for (int k = 0; k < 2000; k++) {
+        m.insert(k, k);
+    }
+    CHECK(m.shard_count() == 4);
+    for (int i = 0; i < 200000; i++) {
+        CHECK(m.find(i % 500) == i % 500);
+    }
+    CHECK(m.shard_count() > 4);
+    CHECK(m.size() == 2000);
+}
+
+// Readers scan while writers make shards split and merge. Every multiple of 10 stays in the
+// map throughout and any value is 3 times its key, so scans have to see all multiples of 10, in
+// order, and nothing made up.
+static void testConcurrent() {
+    static constexpr int kKeys = 5000;
+    ShardedBTreeMap<int, int> m({}, 64);
+    for (int k = 0; k < kKeys; k += 10) {
+        m.insert(k, 3 * k);
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> maxShards{0};
+    std::vector<std::thread> writers, readers;
+    for (int w = 0; w < 2; w++) {
+        writers.emplace_back([&m, &maxShards, w]() {
+            std::mt19937 rng(w);
+            for (int phase = 0; phase < 4; phase++) {
+                for (int i = 0; i < 10000; i++) {
+                    int k = rng() % kKeys;
+                    if (k % 10 == 0) {
+                        continue;
+                    }
+                    if (phase % 2 == 0 ? rng() % 4 != 0 : rng() % 8 == 0) {
+                        m.insert(k, 3 * k);
+                    } else {
+                        m.remove(k);
+                    }
+                }
+                auto n = m.shard_count();
+                if (n > maxShards.load()) {
+                    maxShards.store(n);
+                }
+            }
+            // down to the stable keys, for shards to merge
+            for (int k = w + 1; k < kKeys; k += 2) {
+                if (k % 10 != 0) {
+                    m.remove(k);
+                }
+            }
+        });
+    }
+    for (int r = 0; r < 2; r++) {
+        readers.emplace_back([&m, &stop, r]() {
+            std::mt19937 rng(100 + r);
+            while (!stop) {
+                int last = -1, stable = 0;
+                m.for_each([&](const int &k, const int &v) {
+                    CHECK(k > last && v == 3 * k);
+                    stable += k % 10 == 0;
+                    last = k;
+                });
+                CHECK(stable == kKeys / 10);
+
+                int lo = rng() % kKeys, hi = lo + rng() % 1000;
+                last = lo - 1;
+                stable = 0;
+                m.range_scan(lo, hi, [&](const int &k, const int &v) {
+                    CHECK(k > last && k < hi && v == 3 * k);
+                    stable += k % 10 == 0;
+                    last = k;
+                });
+                CHECK(stable == (std::min(hi, kKeys) + 9) / 10 - (lo + 9) / 10);
+
+                int k = rng() % kKeys;
+                auto v = m.find(k);
+                CHECK(!v || *v == 3 * k);
+                CHECK(k % 10 != 0 || v);
+            }
+        });
+    }
+    for (auto &t : writers) {
+        t.join();
+    }
+    stop = true;
+    for (auto &t : readers) {
+        t.join();
+    }
+    // the shards did split and merge back under the readers
+    CHECK(maxShards.load() > 8);
+    CHECK(m.shard_count() < maxShards.load());
+}
+
+int main() {
+    testAgainstMap();
+    testReadHotSplit();
+    testConcurrent();
+    puts("ok");
+}
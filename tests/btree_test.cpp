@@ -0,0 +1,442 @@
+// Checks for btree.h: the tree itself and what is built on top of it, against sequential or
+// std::map references.
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "btree.h"
+#include "check.h"
+
+using Entries = std::vector<std::pair<int, int>>;
+
+// n distinct non-negative keys in ascending order, each with a value derived from it
+static Entries sortedInput(size_t n, std::mt19937 &rng) {
+    std::vector<int> keys(n);
+    int k = 0;
+    for (auto &key : keys) {
+        k += 1 + rng() % 5;
+        key = k;
+    }
+    Entries ret;
+    for (auto key : keys) {
+        ret.emplace_back(key, key * 7 + 1);
+    }
+    return ret;
+}
+
+template <typename Tree>
+static Entries contentOf(const Tree &t) {
+    Entries ret;
+    t.for_each([&](const int &k, const int &v) { ret.emplace_back(k, v); });
+    return ret;
+}
+
+// parallel bulk load and scans against their sequential counterparts, around node boundaries
+template <unsigned ORDER>
+static void testParallel() {
+    ThreadPool pool(4);
+    std::mt19937 rng(ORDER);
+    for (size_t n : {size_t(0), size_t(1), size_t(ORDER - 1), size_t(ORDER), size_t(ORDER * ORDER), size_t(1000),
+                     size_t(100000)}) {
+        auto input = sortedInput(n, rng);
+        BTree<int, int, ORDER> seq, par;
+        seq.bulk_load(input.begin(), input.end());
+        par.parallel_bulk_load(pool, input.begin(), input.end());
+        seq.traverse();
+        par.traverse();
+        CHECK(par.size() == n);
+        CHECK(contentOf(seq) == input);
+        CHECK(contentOf(par) == input);
+
+        std::mutex mtx;
+        Entries all;
+        par.parallel_for_each(pool, [&](const int &k, const int &v) {
+            std::lock_guard<std::mutex> lk(mtx);
+            all.emplace_back(k, v);
+        });
+        std::sort(all.begin(), all.end());
+        CHECK(all == input);
+
+        for (int i = 0; i < 20; i++) {
+            int lo = n ? rng() % (input.back().first + 10) : 0;
+            int hi = i % 5 == 0 ? lo : lo + rng() % (n * 3 + 10);
+            Entries want, got;
+            seq.range_scan(lo, hi, [&](const int &k, const int &v) { want.emplace_back(k, v); });
+            par.parallel_range_scan(pool, lo, hi, [&](const int &k, const int &v) {
+                std::lock_guard<std::mutex> lk(mtx);
+                got.emplace_back(k, v);
+            });
+            std::sort(got.begin(), got.end());
+            CHECK(got == want);
+        }
+
+        // an exception thrown on the pool reaches the caller, the tree stays as it was
+        if (n > 0) {
+            int bad = input[rng() % n].first;
+            bool thrown = false;
+            try {
+                par.parallel_for_each(pool, [bad](const int &k, const int &) {
+                    if (k == bad) {
+                        throw std::runtime_error("bad key");
+                    }
+                });
+            } catch (const std::runtime_error &) {
+                thrown = true;
+            }
+            CHECK(thrown);
+            CHECK(contentOf(par) == input);
+        }
+    }
+}
+
+// Both frozen layouts against the tree they came from, at sizes around the blocks of the
+// search index (16 ints) and of the compressed leaves (48 one-byte deltas or fewer wider ones).
+// Gaps range from 1 to past 32 bits for 64-bit keys, so leaves of every delta width show up.
+template <typename K>
+static void testFreeze() {
+    std::mt19937_64 rng(sizeof(K));
+    unsigned maxShift = sizeof(K) == 4 ? 14 : 40;
+    for (size_t n : {0, 1, 2, 15, 16, 17, 47, 48, 49, 96, 97, 271, 272, 273, 288, 289, 4624, 4625, 20000}) {
+        BTree<K, int> t;
+        std::vector<K> keys;
+        // unsigned keys start just below the top and wrap around, through the sign bit
+        K k = K(-(rng() % 1000)) - (sizeof(K) == 4 ? 0 : K(1) << 41);
+        for (size_t i = 0; i < n; i++) {
+            unsigned shift = rng() % 4 == 0 ? rng() % (maxShift + 1) : rng() % 3;
+            k += K(1 + rng() % (uint64_t(1) << shift));
+            keys.push_back(k);
+        }
+        // inserted shuffled, so the tree is not a bulk loaded one
+        std::vector<K> order = keys;
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t i = 0; i < n; i++) {
+            t.insert(order[i], int(i));
+        }
+        auto frozen = t.freeze();
+        auto compressed = t.freeze_compressed();
+        CHECK(frozen.size() == n && compressed.size() == n);
+
+        std::vector<K> probes{std::numeric_limits<K>::min(), std::numeric_limits<K>::max(), 0};
+        for (auto key : keys) {
+            probes.push_back(key);
+            probes.push_back(key - 1);
+            probes.push_back(key + 1);
+        }
+        for (auto key : probes) {
+            auto want = t.lower_bound(key);
+            auto a = frozen.lower_bound(key);
+            auto b = compressed.lower_bound(key);
+            CHECK(a.valid() == want.valid() && b.valid() == want.valid());
+            if (want.valid()) {
+                CHECK(a.key() == want.key() && a.val() == want.val());
+                CHECK(b.key() == want.key() && b.val() == want.val());
+            }
+            want = t.find(key);
+            a = frozen.find(key);
+            b = compressed.find(key);
+            CHECK(a.valid() == want.valid() && b.valid() == want.valid());
+            if (want.valid()) {
+                CHECK(a.key() == key && a.val() == want.val());
+                CHECK(b.key() == key && b.val() == want.val());
+            }
+        }
+    }
+}
+
+// freeze() keeps the order of the tree, whatever Cmp it has
+static void testFreezeDescending() {
+    std::mt19937 rng(3);
+    for (size_t n : {0, 1, 16, 17, 272, 273, 5000}) {
+        BTree<int, int, 12, std::greater<int>> t;
+        std::map<int, int, std::greater<int>> ref;
+        while (ref.size() < n) {
+            int k = rng() % (n * 4);
+            if (ref.emplace(k, k + 1).second) {
+                t.insert(k, k + 1);
+            }
+        }
+        auto frozen = t.freeze();
+        CHECK(frozen.size() == n);
+        for (int k = -1; k <= int(n * 4); k++) {
+            auto want = ref.lower_bound(k);
+            auto got = frozen.lower_bound(k);
+            CHECK(got.valid() == (want != ref.end()));
+            CHECK(!got.valid() || (got.key() == want->first && got.val() == want->second));
+            CHECK(frozen.find(k).valid() == ref.count(k));
+        }
+    }
+}
+
+// the structure, size(), front() and the content after a cut, against what was expected to stay
+template <typename Tree>
+static void checkCut(Tree &t, const Entries &kept) {
+    t.traverse();
+    CHECK(t.size() == kept.size());
+    CHECK(contentOf(t) == kept);
+    auto front = t.front();
+    CHECK(front.valid() == !kept.empty());
+    CHECK(!front.valid() || (front.key() == kept[0].first && front.val() == kept[0].second));
+}
+
+// Every cut of a tree several levels deep, on clones of it: before the first key, past the last,
+// on each key and between each two. Cuts on a key land on the separators of inner nodes as well
+// as inside and at the start of leaves.
+template <unsigned ORDER>
+static void testErasePrefix() {
+    std::mt19937 rng(ORDER);
+    Entries input;
+    for (int k = 0; k < 600; k += 2) {
+        input.emplace_back(k, k * 7 + 1);
+    }
+    auto order = input;
+    std::shuffle(order.begin(), order.end(), rng);
+    BTree<int, int, ORDER> t;
+    for (auto &[k, v] : order) {
+        t.insert(k, v);
+    }
+    CHECK(t.stats().height >= 3);
+
+    for (int hi = -1; hi <= 601; hi++) {
+        auto c = t.clone();
+        auto first = std::lower_bound(input.begin(), input.end(), std::make_pair(hi, 0));
+        CHECK(c.erase_prefix(hi) == size_t(first - input.begin()));
+        Entries kept(first, input.end());
+        checkCut(c, kept);
+        // still a working tree afterwards
+        c.insert(601, 0);
+        kept.emplace_back(601, 0);
+        checkCut(c, kept);
+        CHECK(c.back().key() == 601);
+        CHECK(c.remove(598) == (hi <= 598));
+    }
+
+    // an empty prefix leaves the tree alone, the whole tree leaves nothing
+    CHECK(t.erase_prefix(0) == 0);
+    checkCut(t, input);
+    CHECK(t.erase_prefix(600) == input.size());
+    checkCut(t, {});
+    CHECK(t.erase_prefix(600) == 0);
+    t.insert(1, 2);
+    checkCut(t, {{1, 2}});
+}
+
+// repeated cuts of a big tree down to empty, with inserts in between, against std::map
+static void testErasePrefixRandom() {
+    std::mt19937 rng(7);
+    BTree<int, int, 8> t;
+    std::map<int, int> ref;
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 2000; i++) {
+            int k = rng() % 100000;
+            if (ref.emplace(k, i).second) {
+                t.insert(k, i);
+            }
+        }
+        int hi = round == 49 ? 100000 : rng() % 100000;
+        auto last = ref.lower_bound(hi);
+        size_t n = std::distance(ref.begin(), last);
+        ref.erase(ref.begin(), last);
+        CHECK(t.erase_prefix(hi) == n);
+        checkCut(t, Entries(ref.begin(), ref.end()));
+    }
+    CHECK(t.size() == 0);
+}
+
+// past 64 bytes, so the tree keeps it out of line
+struct Wide {
+    long v[10];
+    bool operator==(const Wide &other) const { return std::equal(v, v + 10, other.v); }
+    friend std::ostream &operator<<(std::ostream &os, const Wide &w) { return os << w.v[0]; }
+};
+
+// values kept in the nodes (std::string) or out of line (Wide)
+template <typename V>
+static V valueOf(int i) {
+    if constexpr (std::is_same_v<V, std::string>) {
+        // past the small string buffer, so a value that is copied instead of moved shows up
+        return std::string(20, 'a' + i % 26) + std::to_string(i);
+    } else {
+        Wide w;
+        std::fill(w.v, w.v + 10, i);
+        return w;
+    }
+}
+
+template <typename Tree, typename V>
+static void checkSame(Tree &t, const std::map<int, V> &ref) {
+    t.traverse();
+    CHECK(t.size() == ref.size());
+    auto it = ref.begin();
+    t.for_each([&](const int &k, const V &v) {
+        CHECK(it != ref.end() && it->first == k && it->second == v);
+        ++it;
+    });
+    CHECK(it == ref.end());
+    auto front = t.front(), back = t.back();
+    CHECK(front.valid() == !ref.empty() && back.valid() == !ref.empty());
+    if (!ref.empty()) {
+        CHECK(front.key() == ref.begin()->first && V(front.val()) == ref.begin()->second);
+        CHECK(back.key() == ref.rbegin()->first && V(back.val()) == ref.rbegin()->second);
+    }
+}
+
+// whether the entries of a non-empty tree sit in the root leaf held by the tree object itself
+template <typename Tree>
+static bool inlineRoot(Tree &t) {
+    auto p = reinterpret_cast<const char *>(t.front().node.ptr.get());
+    return p >= reinterpret_cast<const char *>(&t) && p < reinterpret_cast<const char *>(&t + 1);
+}
+
+// The root leaf from inline to the heap and back to inline, with copies and moves of trees in
+// both states, each checked to hold its own entries and to stay usable.
+template <typename V>
+static void testInlineRoot() {
+    constexpr int kLeaf = 11; // ORDER - 1 of the default order
+    using Tree = BTree<int, V>;
+    Tree t;
+    std::map<int, V> ref;
+    checkSame(t, ref);
+    for (int k = 0; k < kLeaf; k++) {
+        t.insert(k, valueOf<V>(k));
+        ref[k] = valueOf<V>(k);
+    }
+    checkSame(t, ref);
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(t));
+#endif
+
+    auto small = t.clone();
+    Tree copied(t);
+    checkSame(small, ref);
+    checkSame(copied, ref);
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(small) && inlineRoot(copied));
+#endif
+    // a change to the copy is not seen by the original
+    small.remove(3);
+    CHECK(t.find(3).valid() && !small.find(3).valid());
+    small.insert(3, valueOf<V>(3));
+
+    // one more entry splits the root, the leaf leaves the tree object
+    t.insert(kLeaf, valueOf<V>(kLeaf));
+    ref[kLeaf] = valueOf<V>(kLeaf);
+    checkSame(t, ref);
+    CHECK(t.stats().height == 2);
+    CHECK(!inlineRoot(t));
+
+    // moves of a spilled tree hand over its nodes, the source is left empty and inline
+    auto big = t.clone();
+    checkSame(big, ref);
+    Tree moved(std::move(t));
+    checkSame(moved, ref);
+    checkSame(t, std::map<int, V>{});
+    t.insert(-1, valueOf<V>(-1));
+    checkSame(t, std::map<int, V>{{-1, valueOf<V>(-1)}});
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(t));
+#endif
+
+    // moves of an inline tree copy its leaf over, into empty and into spilled trees
+    std::map<int, V> smallRef(ref.begin(), std::next(ref.begin(), kLeaf));
+    Tree fromSmall(std::move(small));
+    checkSame(fromSmall, smallRef);
+    checkSame(small, std::map<int, V>{});
+    big = std::move(fromSmall);
+    checkSame(big, smallRef);
+    checkSame(fromSmall, std::map<int, V>{});
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(big));
+#endif
+    // and a spilled one into an inline one
+    copied = std::move(moved);
+    checkSame(copied, ref);
+    checkSame(moved, std::map<int, V>{});
+    auto &self = copied;
+    copied = self;
+    checkSame(copied, ref);
+
+    // removes back to a single leaf keep it on the heap, clearing by a move brings it home
+    copied.remove(0);
+    copied.remove(1);
+    ref.erase(0);
+    ref.erase(1);
+    checkSame(copied, ref);
+    CHECK(copied.stats().height == 1);
+    copied = Tree();
+    copied.insert(5, valueOf<V>(5));
+    checkSame(copied, std::map<int, V>{{5, valueOf<V>(5)}});
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(copied));
+#endif
+
+    // a bulk load that fits one leaf goes to the inline one as well
+    std::vector<std::pair<int, V>> pairs(smallRef.begin(), smallRef.end());
+    copied.bulk_load(pairs.begin(), pairs.end());
+    checkSame(copied, smallRef);
+#ifndef BTREE_COMPACT_NODES
+    CHECK(inlineRoot(copied));
+#endif
+}
+
+// front(), back() and pops from both ends down to empty, through merges and root collapses
+template <typename V, unsigned ORDER>
+static void testPopBothEnds() {
+    std::mt19937 rng(ORDER);
+    BTree<int, V, ORDER> t;
+    std::map<int, V> ref;
+    CHECK(!t.pop_front() && !t.pop_back());
+    for (int round = 0; round < 3; round++) {
+        while (ref.size() < 500) {
+            int k = rng() % 5000;
+            if (ref.emplace(k, valueOf<V>(k)).second) {
+                t.insert(k, valueOf<V>(k));
+            }
+        }
+        size_t step = 0;
+        while (!ref.empty()) {
+            // runs from one end or the other, with inserts in between on some rounds
+            if ((step / 7 + round) % 2) {
+                CHECK(t.pop_front());
+                ref.erase(ref.begin());
+            } else {
+                CHECK(t.pop_back());
+                ref.erase(std::prev(ref.end()));
+            }
+            if (round == 2 && step % 5 == 0) {
+                int k = rng() % 5000;
+                if (ref.emplace(k, valueOf<V>(k)).second) {
+                    t.insert(k, valueOf<V>(k));
+                }
+            }
+            if (step++ % 10 == 0 || ref.size() < 2 * ORDER) {
+                checkSame(t, ref);
+            }
+        }
+        checkSame(t, ref);
+        CHECK(!t.pop_front() && !t.pop_back());
+    }
+}
+
+int main() {
+    testParallel<5>();
+    testParallel<12>();
+    testFreeze<int32_t>();
+    testFreeze<int64_t>();
+    testFreeze<uint64_t>();
+    testFreezeDescending();
+    testErasePrefix<5>();
+    testErasePrefix<12>();
+    testErasePrefixRandom();
+    testInlineRoot<std::string>();
+    testInlineRoot<Wide>();
+    testPopBothEnds<std::string, 5>();
+    testPopBothEnds<Wide, 12>();
+    puts("ok");
+}
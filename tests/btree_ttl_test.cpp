@@ -0,0 +1,102 @@
+// Checks for btree_ttl.h and BTree::erase_prefix. Reads the ttl hwstat counters, so it needs
+// to be built without NO_STATS.
+#include <map>
+#include <random>
+#include <string>
+
+#include "btree_ttl.h"
+#include "check.h"
+
+// cuts at random points of random trees, the tree has to stay in order and keep working
+template <unsigned ORDER>
+static void testErasePrefix() {
+    for (int seed = 0; seed < 100; seed++) {
+        std::mt19937 rng(seed);
+        BTree<int, std::string, ORDER> t;
+        std::map<int, std::string> ref;
+        int n = rng() % (seed % 4 == 0 ? 20 : 5000);
+        for (int i = 0; i < n; i++) {
+            int k = rng() % 20000;
+            if (ref.emplace(k, std::to_string(k)).second) {
+                t.insert(k, std::to_string(k));
+            }
+        }
+        for (int round = 0; round < 4; round++) {
+            int cut = rng() % 22000 - 1000;
+            size_t want = 0;
+            while (!ref.empty() && ref.begin()->first < cut) {
+                ref.erase(ref.begin());
+                want++;
+            }
+            CHECK(t.erase_prefix(cut) == want);
+            CHECK(t.size() == ref.size());
+            t.traverse();
+            auto it = ref.begin();
+            t.for_each([&](const int &k, const std::string &v) {
+                CHECK(it != ref.end() && it->first == k && it->second == v);
+                ++it;
+            });
+            CHECK(it == ref.end());
+            if (!ref.empty()) {
+                CHECK(t.front().key() == ref.begin()->first);
+                CHECK(t.back().key() == ref.rbegin()->first);
+            }
+            // inserts and removes after the cut
+            for (int i = 0; i < 200; i++) {
+                int k = rng() % 20000;
+                if (rng() % 3 == 0) {
+                    CHECK(t.remove(k) == (ref.erase(k) > 0));
+                } else if (ref.emplace(k, std::to_string(k)).second) {
+                    t.insert(k, std::to_string(k));
+                }
+            }
+            t.traverse();
+            CHECK(t.size() == ref.size());
+        }
+    }
+}
+
+// a few entries due at a time are removed from the primary map key by key
+static void testExpireFew() {
+    ExpiringBTreeMap<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m.put(i, i, 1000 + i);
+    }
+    auto rebuilds = ttlRebuilds.stat();
+    for (uint64_t now = 1000; now < 1100; now += 10) {
+        CHECK(m.expire_until(now) == (now == 1000 ? 1 : 10));
+    }
+    CHECK(ttlRebuilds.stat() == rebuilds);
+    CHECK(m.size() == 909);
+    CHECK(!m.find(90, 1090));
+    CHECK(m.find(91, 1090) == 91);
+}
+
+// most of the map due at once rebuilds the primary map from the survivors
+static void testExpireMost() {
+    ExpiringBTreeMap<int, int> m;
+    for (int i = 0; i < 1000; i++) {
+        m.put(i, i, i % 10 == 0 ? 5000 : 100);
+    }
+    auto rebuilds = ttlRebuilds.stat();
+    auto evicted = ttlEvicted.stat();
+    CHECK(m.expire_until(100) == 900);
+    CHECK(ttlRebuilds.stat() == rebuilds + 1);
+    CHECK(ttlEvicted.stat() == evicted + 900);
+    CHECK(m.size() == 100);
+    for (int i = 0; i < 1000; i++) {
+        CHECK(m.find(i, 100).has_value() == (i % 10 == 0));
+    }
+    CHECK(m.expire_until(4999) == 0);
+    CHECK(m.expire_until(5000) == 100);
+    CHECK(m.size() == 0);
+}
+
+int main() {
+    testErasePrefix<7>();
+    testErasePrefix<12>();
+    testErasePrefix<33>();
+    testExpireFew();
+    testExpireMost();
+    puts("ok");
+}
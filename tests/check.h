@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * Shared by the checks in this directory. Each one is a program of its own that exits non-zero
+ * on the first failure, built and run from here with
+ *   g++ -std=c++17 -O2 -I.. btree_foo_test.cpp -o btree_foo_test -lpthread && ./btree_foo_test
+ * The ones that start threads are worth running under -fsanitize=thread as well.
+ */
+#include <cstdio>
+#include <cstdlib>
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                        \
+        }                                                                   \
+    } while (0)
@@ -50,7 +50,7 @@ private:
   std::condition_variable cond;
   std::condition_variable cond_done;
 
-  int num_busy_threads;
+  int num_busy_threads = 0;
   std::queue<std::function<void()>> tasks;
   bool over = false;
 